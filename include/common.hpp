@@ -10,3 +10,39 @@ typedef std::map<name, asset> mapna;
 
 typedef std::vector<std::string> vs;
 
+// Compact status history. dates[i] is the second the offer entered the i-th status of
+// its type (see sell_offer_statuses and buy_offer_statuses in escrow.hpp), and bit i of
+// visited is set once that status has been entered. dates only grows up to the highest
+// status entered, unvisited slots hold 0.
+struct status_log {
+  uint16_t visited = 0;
+  std::vector<time_point_sec> dates;
+
+  void set(const uint8_t & index, const time_point & date)
+  {
+    if (dates.size() <= index) dates.resize(index + 1, time_point_sec(0));
+    dates[index] = time_point_sec(date);
+    visited |= uint16_t(1) << index;
+  }
+
+  bool has(const uint8_t & index) const { return (visited >> index) & 1; }
+
+  time_point_sec get(const uint8_t & index) const
+  {
+    return has(index) ? dates[index] : time_point_sec(0);
+  }
+
+  // date of the last transition, statuses are set in chronological order
+  time_point_sec latest() const
+  {
+    time_point_sec date(0);
+    for (const time_point_sec & d : dates)
+    {
+      if (d > date) date = d;
+    }
+    return date;
+  }
+
+  EOSLIB_SERIALIZE(status_log, (visited)(dates))
+};
+
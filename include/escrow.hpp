@@ -8,6 +8,7 @@
 #include <config.hpp>
 #include <util.hpp>
 #include <common.hpp>
+#include <optional>
 
 using namespace eosio;
 
@@ -28,6 +29,38 @@ CONTRACT escrow : public contract {
 
     ACTION resetoffers();
 
+    ACTION resetchunk(const uint64_t & max_rows, const bool & offers_only);
+
+    ACTION migrateoffrs(const uint64_t & max_rows);
+
+#ifdef LOCAL_TEST
+    // only built for the local test node, see scripts/compile.js
+    ACTION addlgcyoffer(
+      const uint64_t & id,
+      const uint64_t & sell_id,
+      const name & seller,
+      const name & buyer,
+      const name & type,
+      const asset & quantity,
+      const uint64_t & price_percentage,
+      const name & current_status
+    );
+#endif
+
+    ACTION migrateldgr(const uint64_t & max_rows);
+
+#ifdef LOCAL_TEST
+    // only built for the local test node, see scripts/compile.js
+    ACTION addlgcybal(
+      const name & account,
+      const asset & available_balance,
+      const asset & swap_balance,
+      const asset & escrow_balance,
+      const uint64_t & sell_successful,
+      const uint64_t & buy_successful
+    );
+#endif
+
     ACTION deposit(const name & from, const name & to, const asset & quantity, const std::string & memo);
 
     ACTION withdraw(const name & account, const asset & quantity, const std::string & memo);
@@ -38,8 +71,20 @@ CONTRACT escrow : public contract {
 
     ACTION cancelsoffer(const uint64_t & sell_offer_id, const std::string & memo);
 
+    ACTION rejctpending(const uint64_t & sell_offer_id);
+
     ACTION addbuyoffer(const name & buyer, const uint64_t & sell_offer_id, const asset & quantity, const std::string & payment_method, const std::string & memo);
 
+    ACTION marketbuy(
+      const name & buyer,
+      const asset & quantity,
+      const name & fiat_currency,
+      const std::string & payment_method,
+      const uint64_t & max_price_percentage,
+      const uint64_t & max_matches,
+      const std::string & memo
+    );
+
     ACTION delbuyoffer(const uint64_t & buy_offer_id, const std::string & memo);
 
     ACTION accptbuyoffr(const uint64_t & buy_offer_id, const std::string & memo);
@@ -50,6 +95,21 @@ CONTRACT escrow : public contract {
 
     ACTION confrmpaymnt(const uint64_t & buy_offer_id, const std::string & memo);
 
+    // Compact variants of the most frequent trade steps, they behave as the actions above
+    // but take a varint id and no memo.
+    ACTION accptbuyoff2(const unsigned_int & buy_offer_id);
+    ACTION payoffer2(const unsigned_int & buy_offer_id);
+    ACTION confrmpaymn2(const unsigned_int & buy_offer_id);
+    ACTION addoffermsg2(const unsigned_int & buy_offer_id, const string & iv, const string & ephem_key, const string & message, const checksum256 & mac);
+
+    // operation is one of accept, reject or confirm
+    struct seller_operation {
+      uint64_t buy_offer_id;
+      name operation;
+    };
+
+    ACTION batchseller(const name & seller, const std::vector<seller_operation> & operations, const std::string & memo);
+
     ACTION addarbiter(const name & account);
 
     ACTION delarbiter(const name & account);
@@ -68,8 +128,142 @@ CONTRACT escrow : public contract {
 
     ACTION addpublickey(const name & account, const string & public_key, const std::string & memo);
 
+    ACTION prune(const uint64_t & max_rows);
+
+    ACTION prunemsgs(const uint64_t & max_rows);
+
+    ACTION sweep(const uint64_t & max_rows);
+
+    ACTION rankusers(const uint64_t & max_rows);
+
+    ACTION msglog(
+      const uint64_t & id,
+      const uint64_t & buy_offer_id,
+      const name & sender,
+      const name & receiver,
+      const string & iv,
+      const string & ephem_key,
+      const string & message,
+      const checksum256 & mac
+    );
+
+    // Events for indexers, sent inline on every offer status transition and balance change.
+    // The deltas are in util::seeds_symbol units.
+    ACTION offerevent(
+      const uint64_t & id,
+      const uint64_t & sell_id,
+      const name & old_status,
+      const name & new_status,
+      const asset & quantity,
+      const time_point & date
+    );
+
+    ACTION balevent(const name & account, const int64_t & available_delta, const int64_t & swap_delta, const int64_t & escrow_delta);
+
+    ACTION offerlog(
+      const uint64_t & id,
+      const uint64_t & sell_id,
+      const name & seller,
+      const name & buyer,
+      const asset & quantity,
+      const uint64_t & price_percentage,
+      const name & fiat_currency,
+      const name & status,
+      const time_point & created_date,
+      const time_point & closed_date
+    );
+
     ACTION sendconmethd(const uint64_t & buy_offer_id, const string & iv, const string & ephem_key, const string & message, const checksum256 & mac, const std::string & memo);
 
+    // Query actions, they do not modify state and return one page of rows. A page
+    // continues from cursor, next_cursor is where the following page starts when more is set.
+
+    // seller and buyer are optional, a sell offer has no buyer and its quantity is what is available
+    struct offer_filter {
+      name offer_type;
+      name partition;
+      name seller;
+      name buyer;
+    };
+
+    struct offer_summary {
+      uint64_t id;
+      uint64_t sell_id;
+      name seller;
+      name buyer;
+      asset quantity;
+      uint64_t price_percentage;
+      name fiat_currency;
+      name current_status;
+    };
+
+    struct offer_page {
+      std::vector<offer_summary> offers;
+      uint64_t next_cursor;
+      bool more;
+    };
+
+    struct message_entry {
+      uint64_t id;
+      name sender;
+      name receiver;
+      string iv;
+      string ephem_key;
+      string message;
+      checksum256 mac;
+    };
+
+    // a message stored while m.hash.only was set, its payload is only in the msglog traces
+    struct message_anchor_entry {
+      uint64_t id;
+      name sender;
+      name receiver;
+      checksum256 payload_hash;
+    };
+
+    struct message_page {
+      std::vector<message_entry> messages;
+      std::vector<message_anchor_entry> anchors;
+      uint64_t next_cursor;
+      bool more;
+    };
+
+    struct arbitrage_summary {
+      uint64_t offer_id;
+      time_point created_date;
+    };
+
+    struct arbitrage_page {
+      std::vector<arbitrage_summary> arbitrages;
+      uint64_t next_cursor;
+      bool more;
+    };
+
+    [[eosio::action]] offer_page getoffers(const offer_filter & filter, const uint64_t & cursor, const uint64_t & limit);
+
+    [[eosio::action]] message_page getmessages(const uint64_t & buy_offer_id, const uint64_t & cursor, const uint64_t & limit);
+
+    [[eosio::action]] arbitrage_page getarbqueue(const uint64_t & cursor, const uint64_t & limit);
+
+    // the rows of the former balances and trxstats tables, built from the ledger
+    struct balance_view {
+      name account;
+      asset available_balance;
+      asset swap_balance;
+      asset escrow_balance;
+    };
+
+    struct trx_stats_view {
+      name account;
+      uint64_t total_trx;
+      uint64_t sell_successful;
+      uint64_t buy_successful;
+    };
+
+    [[eosio::action]] balance_view getbalance(const name & account);
+
+    [[eosio::action]] trx_stats_view gettrxstats(const name & account);
+
   private:
 
     const name offer_type_sell = name("offer.sell");
@@ -93,18 +287,253 @@ CONTRACT escrow : public contract {
     const name arbitrage_status_inprogress = name("a.inprogress");
     // const name arbitrage_status_finished = name("a.finished");
 
+    // position in these lists is the slot of the status in status_log,
+    // append new statuses at the end so stored histories keep their meaning
+    const name sell_offer_statuses[4] = {
+      sell_offer_status_active,
+      sell_offer_status_soldout,
+      sell_offer_status_canceled,
+      sell_offer_status_successful
+    };
+
+    const name buy_offer_statuses[9] = {
+      buy_offer_status_pending,
+      buy_offer_status_accepted,
+      buy_offer_status_paid,
+      buy_offer_status_confirmed,
+      buy_offer_status_rejected,
+      buy_offer_status_successful,
+      buy_offer_status_flagged,
+      arbitrage_status_pending,
+      arbitrage_status_inprogress
+    };
+
+    const uint64_t max_query_limit = 100;
+    const uint64_t max_query_scan = 500;
+
+    const name seller_operation_accept = name("accept");
+    const name seller_operation_reject = name("reject");
+    const name seller_operation_confirm = name("confirm");
+
+    const name leaderboard_total = name("total");
+    const name leaderboard_sell = name("sell");
+    const name leaderboard_buy = name("buy");
+
+    const name offer_partition_open = name("open");
+    const name offer_partition_inflight = name("inflight");
+    const name offer_partition_terminal = name("terminal");
+
+    const name offer_partitions[3] = { offer_partition_open, offer_partition_inflight, offer_partition_terminal };
+
     void send_transfer(const name & beneficiary, const asset & quantity, const std::string & memo);
-    void add_success_transaction(const name & account, const name & trx_type);
-    void check_sale_success(const uint64_t & buy_offer_id);
+    void check_seeds_user_status(const name & account, const name & min_status);
+    asset get_seeds_per_usd();
+    void add_message(
+      const uint64_t & buy_offer_id,
+      const name & sender,
+      const name & receiver,
+      const string & iv,
+      const string & ephem_key,
+      const string & message,
+      const checksum256 & mac
+    );
+    void send_offer_event(const uint64_t & id, const uint64_t & sell_id, const name & old_status, const name & new_status, const asset & quantity);
+    void send_balance_event(const name & account, const int64_t & available_delta, const int64_t & swap_delta, const int64_t & escrow_delta);
+    void send_offer_log(
+      const uint64_t & id,
+      const uint64_t & sell_id,
+      const name & seller,
+      const name & buyer,
+      const asset & quantity,
+      const uint64_t & price_percentage,
+      const name & fiat_currency,
+      const name & status,
+      const time_point & created_date,
+      const time_point & closed_date
+    );
+    void add_success_transaction(const name & account, const name & trx_type, const uint32_t & count = 1);
+    void rank_account(const name & category, const name & account, const uint64_t & successful);
+    void take_from_sell_offer(const uint64_t & sell_offer_id, const asset & quantity);
+    void return_to_sell_offer(const uint64_t & sell_offer_id, const asset & quantity);
+    uint64_t sweep_buy_offers(const name & partition, const name & status, const uint64_t & cutoff, const uint64_t & max_rows);
+    void close_buy_offers(const uint64_t & sell_offer_id, const uint64_t & count, const asset & sold);
+    uint64_t reject_pending_buy_offers(const uint64_t & sell_offer_id, const uint64_t & max_rows);
+    uint64_t get_next_offer_id();
+    void offer_not_found(const uint64_t & offer_id, const name & offer_type);
+    name get_offer_partition(const name & status);
+    name get_sell_offer_partition(const uint64_t & sell_offer_id);
+    name get_buy_offer_partition(const uint64_t & buy_offer_id);
+    bool are_messages_expired(const uint64_t & buy_offer_id);
+    std::vector<std::pair<name, name>> get_reset_plan(const bool & offers_only);
+    uint64_t erase_table_rows(const name & table, const name & scope, const uint64_t & max_rows);
+
+    template <typename T>
+    uint64_t erase_rows(const name & scope, const uint64_t & max_rows)
+    {
+      T table_t(get_self(), scope.value);
+      uint64_t erased = 0;
+
+      auto itr = table_t.begin();
+      while (itr != table_t.end() && erased < max_rows)
+      {
+        itr = table_t.erase(itr);
+        erased++;
+      }
+
+      return erased;
+    }
+
+    // Erases the messages of buy offers whose retention has passed, walking bybuyid from
+    // the buy offer id in cursor. Each erased message and each skipped buy offer uses one
+    // unit of budget. Returns where the next call resumes, 0 once the end was reached.
+    template <typename T>
+    uint64_t erase_expired_messages(const uint64_t & cursor, uint64_t & budget)
+    {
+      T messages_t(get_self(), get_self().value);
+      auto messages_by_buy = messages_t.template get_index<name("bybuyid")>();
+
+      auto mitr = messages_by_buy.lower_bound(uint128_t(cursor) << 64);
+      while (mitr != messages_by_buy.end() && budget > 0)
+      {
+        uint64_t buy_offer_id = mitr->buy_offer_id;
+        budget--;
+
+        if (!are_messages_expired(buy_offer_id))
+        {
+          mitr = messages_by_buy.lower_bound(uint128_t(buy_offer_id + 1) << 64);
+          continue;
+        }
+
+        mitr = messages_by_buy.erase(mitr);
+        while (mitr != messages_by_buy.end() && mitr->buy_offer_id == buy_offer_id && budget > 0)
+        {
+          mitr = messages_by_buy.erase(mitr);
+          budget--;
+        }
+      }
+
+      return mitr != messages_by_buy.end() ? mitr->buy_offer_id : 0;
+    }
+
+    template <typename T>
+    name find_offer_partition(const uint64_t & offer_id)
+    {
+      for (const name & partition : offer_partitions)
+      {
+        T offers_t(get_self(), partition.value);
+        if (offers_t.find(offer_id) != offers_t.end()) return partition;
+      }
+      return name();
+    }
+
+    // Records a status transition. A status in the same partition is a plain modify,
+    // otherwise the row moves to the scope of its new partition. The iterator is not
+    // valid after a move.
+    template <typename T, typename F>
+    void update_offer_status(T & offers_t, typename T::const_iterator itr, const name & status, F && modifier)
+    {
+      name partition = get_offer_partition(status);
+      name old_status = itr->current_status;
+
+      if (partition.value == offers_t.get_scope())
+      {
+        offers_t.modify(itr, _self, [&](auto & offer){
+          offer.status_history.set(get_status_index(offer, status), current_time_point());
+          offer.current_status = status;
+          modifier(offer);
+        });
+        send_offer_event(*itr, old_status);
+        return;
+      }
+
+      auto offer = *itr;
+      offer.status_history.set(get_status_index(offer, status), current_time_point());
+      offer.current_status = status;
+      modifier(offer);
+
+      offers_t.erase(itr);
+
+      T partition_t(get_self(), partition.value);
+      partition_t.emplace(_self, [&](auto & item){
+        item = offer;
+      });
+
+      update_market_filters(offer, partition);
+      send_offer_event(offer, old_status);
+    }
+
+    template <typename T>
+    void update_offer_status(T & offers_t, typename T::const_iterator itr, const name & status)
+    {
+      update_offer_status(offers_t, itr, status, [](auto & offer){});
+    }
 
     DEFINE_CONFIG_TABLE
-    DEFINE_CONFIG_GET
 
     DEFINE_USERS_TABLE
 
     DEFINE_SEEDS_PRICE_TABLE
     DEFINE_SEEDS_PRICE_MULTI_INDEX
 
+    // balances and trade counters of a user in one row, amounts are in util::seeds_symbol units
+    TABLE ledger_table {
+      name account;
+      int64_t available;
+      int64_t swap;
+      int64_t escrow;
+      uint32_t total_trx;
+      uint32_t sell_successful;
+      uint32_t buy_successful;
+
+      asset available_balance () const { return asset(available, util::seeds_symbol); }
+      asset swap_balance () const { return asset(swap, util::seeds_symbol); }
+      asset escrow_balance () const { return asset(escrow, util::seeds_symbol); }
+
+      void add_successful_trades (const bool & as_seller, const uint32_t & count) {
+        total_trx += count;
+        if (as_seller) sell_successful += count;
+        else buy_successful += count;
+      }
+
+      uint64_t primary_key () const { return account.value; }
+    };
+
+    typedef eosio::multi_index<name("ledger"), ledger_table> ledger_tables;
+
+    // top l.size accounts by successful trades, scoped by category (total, sell or buy)
+    TABLE leaderboard_table {
+      name account;
+      uint64_t successful;
+
+      uint64_t primary_key () const { return account.value; }
+      uint128_t by_successful () const { return (uint128_t(successful) << 64) + account.value; }
+    };
+
+    typedef eosio::multi_index<name("leaderboard"), leaderboard_table,
+      indexed_by<name("bysuccess"),
+      const_mem_fun<leaderboard_table, uint128_t, &leaderboard_table::by_successful>>
+    > leaderboard_tables;
+
+    // size of each leaderboard and its lowest count, so a trade that can not enter the
+    // board is settled with a single read
+    TABLE leaderboard_state_table {
+      name category;
+      uint64_t size;
+      uint64_t threshold;
+
+      uint64_t primary_key () const { return category.value; }
+    };
+
+    typedef eosio::multi_index<name("lbstate"), leaderboard_state_table> leaderboard_state_tables;
+
+    // next ledger account rankusers offers to the leaderboards
+    TABLE rank_cursor_table {
+      name account;
+    };
+
+    typedef singleton<name("rankcursor"), rank_cursor_table> rank_cursor_tables;
+
+    // balances and trxstats are only read by migrateldgr
     TABLE balances_table {
       name account;
       asset available_balance;
@@ -126,6 +555,159 @@ CONTRACT escrow : public contract {
       uint128_t by_buy_account () const { return (uint128_t(buy_successful) << 64) + account.value; }
     };
 
+    // offers are stored in one scope per lifecycle partition (see get_offer_partition),
+    // so the status is implied by the scope and does not need its own index entries.
+    //
+    // Every partition uses the same typedef, so inflight and terminal rows also carry the
+    // market indexes (bycurprice, bycurtz) and terminal buy offers carry bystatusdate.
+    // A lean typedef per scope would make every lookup by id, which can land in any of
+    // the three scopes, handle two table types and would give the same table different
+    // index positions depending on the scope. The extra entries are bounded instead:
+    // inflight rows are short lived and terminal rows are archived by prune after
+    // o.prune.age.
+    TABLE sell_offer_table {
+      uint64_t id;
+      name seller;
+      asset total_offered;
+      asset available;
+      uint64_t price_percentage;
+      uint64_t seeds_per_usd;
+      time_point created_date;
+      status_log status_history;
+      mapss payment_methods;
+      name current_status;
+      name time_zone;
+      name fiat_currency;
+      asset sold;
+      uint64_t open_buy_offers;
+
+      uint64_t primary_key () const { return id; }
+      uint128_t by_seller_id () const { return (uint128_t(seller.value) << 64) + id; }
+      uint128_t by_currency_price () const { return (uint128_t(fiat_currency.value) << 64) + price_percentage; }
+      uint128_t by_currency_timezone () const { return (uint128_t(fiat_currency.value) << 64) + time_zone.value; }
+    };
+
+    typedef eosio::multi_index<name("selloffers"), sell_offer_table,
+      indexed_by<name("bysellerid"),
+      const_mem_fun<sell_offer_table, uint128_t, &sell_offer_table::by_seller_id>>,
+      indexed_by<name("bycurprice"),
+      const_mem_fun<sell_offer_table, uint128_t, &sell_offer_table::by_currency_price>>,
+      indexed_by<name("bycurtz"),
+      const_mem_fun<sell_offer_table, uint128_t, &sell_offer_table::by_currency_timezone>>
+    > sell_offer_tables;
+
+    // one row per payment method of an active sell offer, so the market can be filtered
+    // by (currency, payment method) with a range read. Kept in sync by update_market_filters.
+    TABLE payment_filter_table {
+      uint64_t id;
+      uint64_t sell_offer_id;
+      name fiat_currency;
+      uint64_t payment_method_hash;
+
+      uint64_t primary_key () const { return id; }
+      uint64_t by_sell_offer () const { return sell_offer_id; }
+      uint128_t by_currency_method () const { return (uint128_t(fiat_currency.value) << 64) + payment_method_hash; }
+    };
+
+    typedef eosio::multi_index<name("payfilters"), payment_filter_table,
+      indexed_by<name("bysellid"),
+      const_mem_fun<payment_filter_table, uint64_t, &payment_filter_table::by_sell_offer>>,
+      indexed_by<name("bycurmethod"),
+      const_mem_fun<payment_filter_table, uint128_t, &payment_filter_table::by_currency_method>>
+    > payment_filter_tables;
+
+    TABLE buy_offer_table {
+      uint64_t id;
+      uint64_t sell_id;
+      name seller;
+      name buyer;
+      asset quantity;
+      uint64_t price_percentage;
+      uint64_t seeds_per_usd;
+      time_point created_date;
+      status_log status_history;
+      string payment_method;
+      name current_status;
+      name fiat_currency;
+
+      uint64_t primary_key () const { return id; }
+      uint128_t by_seller_id () const { return (uint128_t(seller.value) << 64) + id; }
+      uint128_t by_buyer_id () const { return (uint128_t(buyer.value) << 64) + id; }
+      uint128_t by_sell_id () const { return (uint128_t(sell_id) << 64) + id; }
+      uint128_t by_status_date () const { return (uint128_t(current_status.value) << 64) + status_history.latest().sec_since_epoch(); }
+    };
+
+    typedef eosio::multi_index<name("buyoffers"), buy_offer_table,
+      indexed_by<name("bysellerid"),
+      const_mem_fun<buy_offer_table, uint128_t, &buy_offer_table::by_seller_id>>,
+      indexed_by<name("bybuyerid"),
+      const_mem_fun<buy_offer_table, uint128_t, &buy_offer_table::by_buyer_id>>,
+      indexed_by<name("bysellid"),
+      const_mem_fun<buy_offer_table, uint128_t, &buy_offer_table::by_sell_id>>,
+      indexed_by<name("bystatusdate"),
+      const_mem_fun<buy_offer_table, uint128_t, &buy_offer_table::by_status_date>>
+    > buy_offer_tables;
+
+    uint8_t get_status_index(const sell_offer_table & offer, const name & status);
+    uint8_t get_status_index(const buy_offer_table & offer, const name & status);
+
+    // called when an offer moves to partition, only active sell offers are in the market filters
+    void update_market_filters(const sell_offer_table & offer, const name & partition);
+    void update_market_filters(const buy_offer_table & offer, const name & partition) {}
+
+    void send_offer_event(const sell_offer_table & offer, const name & old_status)
+    {
+      send_offer_event(offer.id, offer.id, old_status, offer.current_status, offer.available);
+    }
+
+    void send_offer_event(const buy_offer_table & offer, const name & old_status)
+    {
+      send_offer_event(offer.id, offer.sell_id, old_status, offer.current_status, offer.quantity);
+    }
+
+    uint64_t add_buy_offer(
+      const name & buyer,
+      sell_offer_tables & selloffers_t,
+      sell_offer_tables::const_iterator sitr,
+      const asset & quantity,
+      const std::string & payment_method
+    );
+
+    // sell and buy offers share one id sequence, so an id keeps pointing to a single offer
+    TABLE offer_ids_table {
+      uint64_t next_id;
+    };
+
+    typedef singleton<name("offerids"), offer_ids_table> offer_ids_tables;
+
+    // cursor of a resetchunk run, step indexes the (table, scope) list of get_reset_plan
+    TABLE reset_state_table {
+      uint64_t step;
+      uint64_t rows_erased;
+      bool offers_only;
+      name table;
+      name scope;
+    };
+
+    typedef singleton<name("resetstate"), reset_state_table> reset_state_tables;
+
+    // where the next prune call resumes scanning the terminal partition
+    TABLE prune_state_table {
+      uint64_t buy_offer_id;
+      uint64_t sell_offer_id;
+    };
+
+    typedef singleton<name("prunestate"), prune_state_table> prune_state_tables;
+
+    // where the next prunemsgs call resumes in pmessages and msganchors
+    TABLE message_prune_state_table {
+      uint64_t message_buy_offer_id;
+      uint64_t anchor_buy_offer_id;
+    };
+
+    typedef singleton<name("msgprune"), message_prune_state_table> message_prune_state_tables;
+
+    // legacy layout, only read by migrateoffrs until every row has been moved to selloffers/buyoffers
     TABLE offer_table {
       uint64_t id;
       uint64_t sell_id;
@@ -204,6 +786,17 @@ CONTRACT escrow : public contract {
 
     typedef eosio::multi_index<name("balances"), balances_table> balances_tables;
 
+    // status of seeds users as last read from accts.seeds, kept for s.status.ttl seconds
+    TABLE seeds_status_table {
+      name account;
+      name status;
+      time_point_sec updated_date;
+
+      uint64_t primary_key () const { return account.value; }
+    };
+
+    typedef eosio::multi_index<name("seedsstatus"), seeds_status_table> seeds_status_tables;
+
     typedef eosio::multi_index<name("trxstats"), transactions_stats_table,
       indexed_by<name("bytotalacct"),
       const_mem_fun<transactions_stats_table, uint128_t, &transactions_stats_table::by_total_account>>,
@@ -223,6 +816,54 @@ CONTRACT escrow : public contract {
 
     config_tables config;
 
+    // typed copy of the known config parameters, kept in sync by setparam so an action
+    // reads all of them from a single row. Bit i of initialized is set by the i-th entry
+    // of settings_fields.
+    TABLE settings_table {
+      uint64_t initialized;
+      uint64_t accept_limit;        // b.accpt.lim
+      uint64_t confirm_limit;       // b.confrm.lim
+      uint64_t prune_age;           // o.prune.age
+      uint64_t cancel_batch;        // s.cancl.btch
+      uint64_t status_ttl;          // s.status.ttl
+      uint64_t price_snapshot_age;  // p.snap.age
+      uint64_t hash_only_messages;  // m.hash.only
+      uint64_t message_retention;   // m.retention
+      uint64_t leaderboard_size;    // l.size
+      uint64_t pay_limit;           // b.pay.lim
+    };
+
+    typedef singleton<name("settings"), settings_table> settings_tables;
+
+    struct settings_field {
+      name key;
+      uint64_t default_value;       // used by get_settings for parameters that were never set
+      uint64_t settings_table::* member;
+    };
+
+    static constexpr settings_field settings_fields[] = {
+      { name("b.accpt.lim"), 7200, &settings_table::accept_limit },
+      { name("b.confrm.lim"), 86400, &settings_table::confirm_limit },
+      { name("o.prune.age"), 2592000, &settings_table::prune_age },
+      { name("s.cancl.btch"), 50, &settings_table::cancel_batch },
+      { name("s.status.ttl"), 3600, &settings_table::status_ttl },
+      { name("p.snap.age"), 300, &settings_table::price_snapshot_age },
+      { name("m.hash.only"), 0, &settings_table::hash_only_messages },
+      { name("m.retention"), 604800, &settings_table::message_retention },
+      { name("l.size"), 50, &settings_table::leaderboard_size },
+      { name("b.pay.lim"), 86400, &settings_table::pay_limit }
+    };
+
+    static constexpr size_t settings_count = std::size(settings_fields);
+    static_assert(settings_count == sizeof(settings_table) / sizeof(uint64_t) - 1, "every settings_table field needs a settings_fields entry");
+
+    static constexpr uint64_t settings_initialized = (uint64_t(1) << settings_count) - 1;
+
+    std::optional<settings_table> settings_cache;
+
+    const settings_table & get_settings();
+    bool set_setting(settings_table & settings, const name & key, const SettingsValues & value);
+
 
     TABLE arbitrage_offers_table {
       uint64_t offer_id;
@@ -251,6 +892,15 @@ CONTRACT escrow : public contract {
 
     typedef singleton<"price"_n, price_table> price_tables;
 
+    // copy of the tlosto.seeds price, read again once it is older than p.snap.age seconds
+    TABLE price_snapshot_table {
+      asset seeds_per_usd;
+      uint64_t round_id;
+      time_point_sec fetched_date;
+    };
+
+    typedef singleton<name("pricesnap"), price_snapshot_table> price_snapshot_tables;
+
     TABLE user_public_key_table {
       name account;
       string public_key;
@@ -287,6 +937,25 @@ CONTRACT escrow : public contract {
       const_mem_fun<private_message_table, uint128_t, &private_message_table::by_receiver_id>>
     > private_message_tables;
 
+    // with m.hash.only set, a message only keeps the sha256 of its packed (iv, ephem_key,
+    // message, mac) here, the payload itself goes to indexers through msglog. Ids are shared
+    // with pmessages, so a message id is found in exactly one of the two tables.
+    TABLE message_anchor_table {
+      uint64_t id;
+      uint64_t buy_offer_id;
+      name sender;
+      name receiver;
+      checksum256 payload_hash;
+
+      uint64_t primary_key () const { return id; }
+      uint128_t by_buy_id () const { return (uint128_t(buy_offer_id) << 64) + id; }
+    };
+
+    typedef eosio::multi_index<name("msganchors"), message_anchor_table,
+      indexed_by<name("bybuyid"),
+      const_mem_fun<message_anchor_table, uint128_t, &message_anchor_table::by_buy_id>>
+    > message_anchor_tables;
+
 };
 
 extern "C" void apply(uint64_t receiver, uint64_t code, uint64_t action) {
@@ -295,12 +964,13 @@ extern "C" void apply(uint64_t receiver, uint64_t code, uint64_t action) {
   } else if (code == receiver) {
       switch (action) {
           EOSIO_DISPATCH_HELPER(escrow,
-          (reset)(resetoffers)
+          (reset)(resetoffers)(resetchunk)(migrateoffrs)(migrateldgr)
           (withdraw)
           (upsertuser)
-          (addselloffer)(cancelsoffer)
-          (addbuyoffer)(delbuyoffer)
-          (accptbuyoffr)(rejctbuyoffr)(payoffer)(confrmpaymnt)
+          (addselloffer)(cancelsoffer)(rejctpending)
+          (addbuyoffer)(marketbuy)(delbuyoffer)
+          (accptbuyoffr)(rejctbuyoffr)(payoffer)(confrmpaymnt)(batchseller)
+          (accptbuyoff2)(payoffer2)(confrmpaymn2)(addoffermsg2)
           (addarbiter)(delarbiter)
           (initarbitrage)
           (arbtrgeoffer)
@@ -308,7 +978,14 @@ extern "C" void apply(uint64_t receiver, uint64_t code, uint64_t action) {
           (resetsttngs)
           (addpublickey)(addoffermsg)(delprivtemsg)
           (sendconmethd)
+          (prune)(prunemsgs)(sweep)(rankusers)(offerlog)(msglog)(offerevent)(balevent)
+          (getoffers)(getmessages)(getarbqueue)(getbalance)(gettrxstats)
         )
       }
+#ifdef LOCAL_TEST
+      switch (action) {
+          EOSIO_DISPATCH_HELPER(escrow, (addlgcyoffer)(addlgcybal))
+      }
+#endif
   }
 }
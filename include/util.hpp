@@ -2,6 +2,7 @@
 
 #include <eosio/name.hpp>
 #include <eosio/asset.hpp>
+#include <eosio/multi_index.hpp>
 #include <tables/seeds.users.hpp>
 #include <contracts.hpp>
 #include <variant>
@@ -23,25 +24,52 @@ namespace util
     check(quantity.amount > 0, "quantity must be greater than 0");
   }
 
-  void check_seeds_user_status(const name & account, const name & min_status)
+  // 64 bit FNV-1a of a string, to use it as part of an index key
+  uint64_t hash_string(const string & value)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char & c : value)
+    {
+      hash ^= uint8_t(c);
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  // Reads only account and status, the first two fields of the seeds user row, instead
+  // of unpacking the whole row with its profile strings. Returns an empty name when the
+  // account is not a seeds user.
+  name get_seeds_user_status(const name & account)
   {
-    DEFINE_SEEDS_USER_TABLE
-    DEFINE_SEEDS_USER_TABLE_MULTI_INDEX
+    int32_t itr = internal_use_do_not_use::db_find_i64(seeds::accounts.value, seeds::accounts.value, name("users").value, account.value);
+    if (itr < 0) return name();
 
-    user_tables seeds_users(seeds::accounts, seeds::accounts.value);
+    uint64_t fields[2];
+    internal_use_do_not_use::db_get_i64(itr, fields, sizeof(fields));
+
+    return name(fields[1]);
+  }
 
-    auto uitr = seeds_users.find(account.value);
-    check(uitr != seeds_users.end(), account.to_string() + " account is not a seeds user");
-    
-    switch(min_status)
+  bool has_seeds_user_status(const name & status, const name & min_status)
+  {
+    switch(min_status.value)
     {
-      case seeds_resident_status:
-        check(uitr->status == seeds_resident_status || uitr->status == seeds_citizen_status,
-          "user must be at least a " + min_status.to_string());
-        break;
-      case seeds_citizen_status:
-        check(uitr->status == seeds_citizen_status, "user must be at least a " + min_status.to_string());
-        break;
+      case seeds_resident_status.value:
+        return status == seeds_resident_status || status == seeds_citizen_status;
+      case seeds_citizen_status.value:
+        return status == seeds_citizen_status;
     }
+    return status != name();
+  }
+
+  void check_seeds_user_status(const name & account, const name & status, const name & min_status)
+  {
+    check(status != name(), account.to_string() + " account is not a seeds user");
+    check(has_seeds_user_status(status, min_status), "user must be at least a " + min_status.to_string());
+  }
+
+  void check_seeds_user_status(const name & account, const name & min_status)
+  {
+    check_seeds_user_status(account, get_seeds_user_status(account), min_status);
   }
 }
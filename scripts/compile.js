@@ -4,6 +4,7 @@ const { exec } = require('child_process')
 const { promisify } = require('util')
 const fs = require('fs')
 const { join } = require('path')
+const { isLocalNode } = require('./config')
 
 const execCommand = promisify(exec)
 
@@ -20,11 +21,14 @@ async function compileContract ({
 
   const compiled = join(__dirname, '../compiled')
   let cmd = ""
+
+  // actions that rehearse upgrades on the local node are left out of every other build
+  const flags = isLocalNode() ? '-DLOCAL_TEST' : ''
   
   if (process.env.COMPILER === 'local') {
-    cmd = `eosio-cpp -abigen -I ./include -contract ${contract} -o ./compiled/${contract}.wasm ${path}`
+    cmd = `eosio-cpp -abigen ${flags} -I ./include -contract ${contract} -o ./compiled/${contract}.wasm ${path}`
   } else {
-    cmd = `docker run --rm --name eosio.cdt_v1.6.1 --volume ${join(__dirname, '../')}:/project -w /project eostudio/eosio.cdt:v1.6.1 /bin/bash -c "echo 'starting';eosio-cpp -abigen -I ./include -contract ${contract} -o ./compiled/${contract}.wasm ${path}"`
+    cmd = `docker run --rm --name eosio.cdt_v1.8.1 --volume ${join(__dirname, '../')}:/project -w /project eostudio/eosio.cdt:v1.8.1 /bin/bash -c "echo 'starting';eosio-cpp -abigen ${flags} -I ./include -contract ${contract} -o ./compiled/${contract}.wasm ${path}"`
   }
   console.log("compiler command: " + cmd, '\n')
 
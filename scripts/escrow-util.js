@@ -0,0 +1,256 @@
+const { Serialize } = require('eosjs')
+const { rpc, api } = require('./eos')
+const { contractNames } = require('./config')
+
+const { escrow } = contractNames
+
+// offers are stored in one scope per lifecycle partition
+const offerPartitions = ['open', 'inflight', 'terminal']
+
+// slot order of status_log, must match sell_offer_statuses and buy_offer_statuses
+const sellOfferStatuses = ['s.active', 's.soldout', 's.canceled', 's.successful']
+const buyOfferStatuses = [
+  'b.pending', 'b.accepted', 'b.paid', 'b.confirmd', 'b.rejected',
+  'b.success', 'b.flagged', 'a.pending', 'a.inprogress'
+]
+
+async function getAllRows (table, scope = escrow) {
+  const rows = []
+  let lowerBound = ''
+  let more = true
+
+  while (more) {
+    const res = await rpc.get_table_rows({
+      code: escrow,
+      scope,
+      table,
+      json: true,
+      lower_bound: lowerBound,
+      limit: 1000
+    })
+    rows.push(...res.rows)
+    more = res.more
+    lowerBound = res.next_key
+  }
+
+  return rows
+}
+
+function nameToBigInt (name) {
+  const charmap = '.12345abcdefghijklmnopqrstuvwxyz'
+  let value = 0n
+  for (let i = 0; i < 13; i++) {
+    const c = i < name.length ? BigInt(charmap.indexOf(name[i])) : 0n
+    value |= i < 12 ? (c & 0x1fn) << BigInt(64 - 5 * (i + 1)) : c & 0x0fn
+  }
+  return value
+}
+
+// active sell offers of one fiat currency, cheapest first, read from the bycurprice index
+async function getBestSellOffers (fiatCurrency, limit = 10) {
+  const currency = nameToBigInt(fiatCurrency) << 64n
+  const res = await rpc.get_table_rows({
+    code: escrow,
+    scope: 'open',
+    table: 'selloffers',
+    json: true,
+    index_position: 3,
+    key_type: 'i128',
+    lower_bound: currency.toString(),
+    upper_bound: (currency + 0xffffffffffffffffn).toString(),
+    limit
+  })
+  return res.rows
+}
+
+// same 64 bit FNV-1a as util::hash_string in the contract
+function hashString (value) {
+  let hash = 0xcbf29ce484222325n
+  for (const byte of Buffer.from(value)) {
+    hash ^= BigInt(byte)
+    hash = (hash * 0x100000001b3n) & 0xffffffffffffffffn
+  }
+  return hash
+}
+
+async function getIndexRange (table, scope, indexPosition, key, limit) {
+  const res = await rpc.get_table_rows({
+    code: escrow,
+    scope,
+    table,
+    json: true,
+    index_position: indexPosition,
+    key_type: 'i128',
+    lower_bound: key.toString(),
+    upper_bound: key.toString(),
+    limit
+  })
+  return res.rows
+}
+
+// active sell offers of one fiat currency and time zone, read from the bycurtz index
+async function getSellOffersByTimeZone (fiatCurrency, timeZone, limit = 10) {
+  return getIndexRange('selloffers', 'open', 4, (nameToBigInt(fiatCurrency) << 64n) + nameToBigInt(timeZone), limit)
+}
+
+// active sell offers of one fiat currency that accept a payment method, read from payfilters
+async function getSellOffersByPaymentMethod (fiatCurrency, paymentMethod, limit = 10) {
+  const filters = await getIndexRange('payfilters', escrow, 3, (nameToBigInt(fiatCurrency) << 64n) + hashString(paymentMethod), limit)
+
+  const offers = await Promise.all(filters.map(async ({ sell_offer_id: id }) => {
+    const res = await rpc.get_table_rows({ code: escrow, scope: 'open', table: 'selloffers', json: true, lower_bound: id, upper_bound: id, limit: 1 })
+    return res.rows[0]
+  }))
+  return offers.sort((a, b) => a.id - b.id)
+}
+
+// offerevent and balevent notifications sent inline by a transaction, in execution order
+function getEvents (res) {
+  return res.processed.action_traces
+    .filter(trace => trace.act.account === escrow && ['offerevent', 'balevent'].includes(trace.act.name))
+    .sort((a, b) => a.action_ordinal - b.action_ordinal)
+    .map(trace => ({ name: trace.act.name, data: trace.act.data }))
+}
+
+// runs one of the get* query actions as a read-only transaction and returns the value
+// it returned, nothing is signed or billed to actor
+async function query (action, data, actor) {
+  const { serializedTransaction } = await api.transact({
+    actions: [{
+      account: escrow,
+      name: action,
+      authorization: [{ actor, permission: 'active' }],
+      data
+    }]
+  }, { broadcast: false, sign: false, blocksBehind: 3, expireSeconds: 30 })
+
+  const res = await rpc.fetch('/v1/chain/push_ro_transaction', {
+    transaction: {
+      signatures: [],
+      compression: 0,
+      packed_context_free_data: '',
+      packed_trx: Serialize.arrayToHex(serializedTransaction)
+    },
+    return_failure_traces: false
+  })
+  return res.result.action_traces[0].return_value_data
+}
+
+function toSeeds (amount) {
+  return `${(Number(amount) / 10000).toFixed(4)} SEEDS`
+}
+
+// ledger rows in the shape of the former balances table
+async function getBalances () {
+  const rows = await getAllRows('ledger')
+  return {
+    rows: rows.map(row => ({
+      account: row.account,
+      available_balance: toSeeds(row.available),
+      swap_balance: toSeeds(row.swap),
+      escrow_balance: toSeeds(row.escrow)
+    }))
+  }
+}
+
+// ledger rows in the shape of the former trxstats table
+async function getTrxStats () {
+  const rows = await getAllRows('ledger')
+  return {
+    rows: rows.map(row => ({
+      account: row.account,
+      total_trx: row.total_trx,
+      sell_successful: row.sell_successful,
+      buy_successful: row.buy_successful
+    }))
+  }
+}
+
+async function getPartitionedRows (table) {
+  const rows = await Promise.all(offerPartitions.map(partition => getAllRows(table, partition)))
+  return rows.flat().sort((a, b) => a.id - b.id)
+}
+
+function statusLogToLegacy (statusLog, statuses) {
+  return statuses
+    .map((key, index) => ({ key, index }))
+    .filter(({ index }) => (statusLog.visited >> index) & 1)
+    .map(({ key, index }) => ({ key, value: `${statusLog.dates[index]}.000` }))
+}
+
+function sellOfferToLegacy (offer) {
+  return {
+    id: offer.id,
+    sell_id: offer.id,
+    seller: offer.seller,
+    buyer: '',
+    type: 'offer.sell',
+    quantity_info: [
+      { key: 'available', value: offer.available },
+      { key: 'totaloffered', value: offer.total_offered }
+    ],
+    price_info: [
+      { key: 'priceper', value: offer.price_percentage },
+      { key: 'seedsperusd', value: offer.seeds_per_usd }
+    ],
+    created_date: offer.created_date,
+    status_history: statusLogToLegacy(offer.status_history, sellOfferStatuses),
+    payment_methods: offer.payment_methods,
+    current_status: offer.current_status,
+    time_zone: offer.time_zone,
+    fiat_currency: offer.fiat_currency
+  }
+}
+
+function buyOfferToLegacy (offer, sellOffer) {
+  const paymentMethod = sellOffer && sellOffer.payment_methods.find(el => el.key === offer.payment_method)
+  return {
+    id: offer.id,
+    sell_id: offer.sell_id,
+    seller: offer.seller,
+    buyer: offer.buyer,
+    type: 'offer.buy',
+    quantity_info: [
+      { key: 'buyquantity', value: offer.quantity }
+    ],
+    price_info: [
+      { key: 'priceper', value: offer.price_percentage },
+      { key: 'seedsperusd', value: offer.seeds_per_usd }
+    ],
+    created_date: offer.created_date,
+    status_history: statusLogToLegacy(offer.status_history, buyOfferStatuses),
+    payment_methods: [
+      { key: offer.payment_method, value: paymentMethod ? paymentMethod.value : '' }
+    ],
+    current_status: offer.current_status,
+    time_zone: sellOffer ? sellOffer.time_zone : '',
+    fiat_currency: offer.fiat_currency
+  }
+}
+
+// Returns the offers in the layout of the old `offers` table, so readers written
+// against it keep working while rows are migrated to selloffers/buyoffers
+async function getOffers () {
+  const [legacyOffers, sellOffers, buyOffers] = await Promise.all([
+    getAllRows('offers'),
+    getPartitionedRows('selloffers'),
+    getPartitionedRows('buyoffers')
+  ])
+
+  const sellOffersById = {}
+  for (const offer of sellOffers) {
+    sellOffersById[offer.id] = offer
+  }
+
+  const rows = [
+    ...legacyOffers,
+    ...sellOffers.map(sellOfferToLegacy),
+    ...buyOffers.map(offer => buyOfferToLegacy(offer, sellOffersById[offer.sell_id]))
+  ].sort((a, b) => a.id - b.id)
+
+  return { rows }
+}
+
+module.exports = {
+  offerPartitions, sellOfferStatuses, buyOfferStatuses, getAllRows, nameToBigInt, getEvents, getBestSellOffers, getSellOffersByTimeZone, getSellOffersByPaymentMethod, query, getBalances, getTrxStats, getPartitionedRows, getOffers, sellOfferToLegacy, buyOfferToLegacy
+}
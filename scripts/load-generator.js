@@ -0,0 +1,331 @@
+// Drives the full trade lifecycle against a local node with generated SEEDS users.
+//
+//   node scripts/load-generator.js [config.json] [--report report.json]
+//
+// Every window it prints the sustained actions per second, the rejected transactions
+// and the p50/p99 cpu of each action next to the number of offers created so far.
+
+const fs = require('fs')
+const { rpc, api, transact } = require('./eos')
+const { contractNames, publicKeys, owner, isLocalNode, sleep } = require('./config')
+const { nameToBigInt } = require('./escrow-util')
+const { seedsContracts, seedsAccounts } = require('./seeds-util')
+const { accountExists } = require('./eosio-errors')
+const { setParamsValue } = require('./contract-settings')
+
+const { escrow } = contractNames
+
+const defaultConfig = {
+  users: 2000,
+  arbiters: 5,
+  // transactions per second the driver tries to sustain
+  rate: 20,
+  concurrency: 50,
+  durationSeconds: 600,
+  reportSeconds: 10,
+  // weights of the flows picked for every trade
+  mix: { trade: 0.8, messages: 0.15, arbitration: 0.05 },
+  funder: seedsAccounts.firstuser,
+  funding: '100.0000 SEEDS',
+  quantity: '1.0000 SEEDS',
+  // max_transaction_cpu_usage of the node, the report flags the first window over it
+  cpuLimitUs: 150000,
+  setupBatch: 20,
+  // use accptbuyoff2, payoffer2, confrmpaymn2 and addoffermsg2 for the trade steps
+  compactActions: false
+}
+
+const nameChars = 'abcdefghijklmnopqrstuvwxyz12345'
+
+function userName (index) {
+  let suffix = ''
+  for (let i = 0; i < 7; i++) {
+    suffix = nameChars[index % nameChars.length] + suffix
+    index = Math.floor(index / nameChars.length)
+  }
+  return `ldgen${suffix}`
+}
+
+function action (account, name, data, actor) {
+  return { account, name, authorization: [{ actor, permission: 'active' }], data }
+}
+
+function percentile (values, p) {
+  if (values.length === 0) return 0
+  const sorted = [...values].sort((a, b) => a - b)
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))]
+}
+
+function errorMessage (error) {
+  try {
+    return error.json.error.details[0].message
+  } catch (err) {
+    return error.message
+  }
+}
+
+async function inBatches (items, size, toActions) {
+  for (let start = 0; start < items.length; start += size) {
+    await transact({ actions: items.slice(start, start + size).flatMap(toActions) })
+  }
+}
+
+async function createUsers (users, config) {
+  console.log(`create ${users.length} accounts`)
+  const authority = { threshold: 1, keys: [{ key: publicKeys.active, weight: 1 }], accounts: [], waits: [] }
+  const newAccount = user => action('eosio', 'newaccount', { creator: owner, name: user, owner: authority, active: authority }, owner)
+
+  for (let start = 0; start < users.length; start += config.setupBatch) {
+    const batch = users.slice(start, start + config.setupBatch)
+    try {
+      await transact({ actions: batch.map(newAccount) })
+    } catch (error) {
+      // a previous run created some of them already
+      for (const user of batch) {
+        try {
+          await transact({ actions: [newAccount(user)] })
+        } catch (error) {
+          accountExists(error)
+        }
+      }
+    }
+  }
+
+  // the field names of the seeds stand-ins come from their abi, the tests call them positionally
+  const accounts = await api.getContract(seedsContracts.accounts)
+  const seedsAction = (name, ...args) => {
+    const fields = accounts.actions.get(name).fields
+    const data = Object.fromEntries(fields.map((field, index) => [field.name, args[index]]))
+    return action(seedsContracts.accounts, name, data, seedsContracts.accounts)
+  }
+
+  console.log('register them as seeds residents, fund and upsert them')
+  await inBatches(users, config.setupBatch, user => [
+    seedsAction('adduser', user, user, 'individual'),
+    seedsAction('testresident', user)
+  ])
+  await inBatches(users, config.setupBatch, user => [
+    action(seedsContracts.token, 'transfer', { from: config.funder, to: user, quantity: config.funding, memo: 'load generator' }, config.funder)
+  ])
+  await inBatches(users, config.setupBatch, user => [
+    action(escrow, 'upsertuser', {
+      account: user,
+      contact_methods: [{ key: 'signal', value: user }],
+      payment_methods: [{ key: 'paypal', value: user }],
+      time_zone: 'gmt',
+      fiat_currency: 'usd',
+      memo: ''
+    }, user)
+  ])
+}
+
+class Metrics {
+  constructor () {
+    this.windows = []
+    this.startWindow()
+  }
+
+  startWindow () {
+    this.window = { started: Date.now(), accepted: 0, rejected: 0, errors: {}, cpu: {} }
+  }
+
+  accepted (name, cpuUs) {
+    this.window.accepted++
+    if (!this.window.cpu[name]) this.window.cpu[name] = []
+    this.window.cpu[name].push(cpuUs)
+  }
+
+  rejected (name, error) {
+    this.window.rejected++
+    const key = `${name}: ${errorMessage(error)}`
+    this.window.errors[key] = (this.window.errors[key] || 0) + 1
+  }
+
+  async close (config) {
+    const { window } = this
+    const seconds = (Date.now() - window.started) / 1000
+    const ids = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'offerids', json: true, limit: 1 })
+
+    const cpu = {}
+    for (const [name, values] of Object.entries(window.cpu)) {
+      cpu[name] = { count: values.length, p50_us: percentile(values, 0.5), p99_us: percentile(values, 0.99) }
+    }
+
+    const summary = {
+      offers: ids.rows.length ? ids.rows[0].next_id : 0,
+      actions_per_second: Number((window.accepted / seconds).toFixed(2)),
+      accepted: window.accepted,
+      rejected: window.rejected,
+      errors: window.errors,
+      cpu,
+      over_cpu_limit: Object.keys(cpu).filter(name => cpu[name].p99_us > config.cpuLimitUs)
+    }
+
+    this.windows.push(summary)
+    this.startWindow()
+    return summary
+  }
+}
+
+async function main () {
+  if (!isLocalNode()) {
+    console.log('The load generator should only be run on local node')
+    process.exit(1)
+  }
+
+  const args = process.argv.slice(2)
+  const reportIndex = args.indexOf('--report')
+  const reportPath = reportIndex >= 0 ? args[reportIndex + 1] : null
+  const configFile = args.find((arg, index) => !arg.startsWith('--') && index !== reportIndex + 1)
+  const config = { ...defaultConfig, ...(configFile ? JSON.parse(fs.readFileSync(configFile)) : {}) }
+
+  const users = Array.from({ length: config.users + config.arbiters }, (_, index) => userName(index))
+  const arbiters = users.slice(0, config.arbiters)
+  const traders = users.slice(config.arbiters)
+
+  await createUsers(users, config)
+
+  for (const arbiter of arbiters) {
+    try {
+      await transact({ actions: [action(escrow, 'addarbiter', { account: arbiter }, escrow)] })
+    } catch (error) {
+      console.log(arbiter, errorMessage(error))
+    }
+  }
+
+  // arbitration can start right after the payment
+  await transact({ actions: [action(escrow, 'setparam', { key: 'b.confrm.lim', value: ['uint64', 0], description: '' }, escrow)] })
+
+  const metrics = new Metrics()
+  let nextSlot = Date.now()
+  let memoCounter = 0
+
+  // paces every transaction to config.rate, the memo keeps equal actions from being duplicates
+  const push = async (name, data, actor, account = escrow) => {
+    const now = Date.now()
+    nextSlot = Math.max(nextSlot + 1000 / config.rate, now)
+    if (nextSlot > now) await sleep(nextSlot - now)
+
+    const label = account === escrow ? name : 'deposit'
+    const memo = `load ${memoCounter++}`
+    try {
+      const res = await transact({ actions: [action(account, name, { ...data, memo }, actor)] })
+      metrics.accepted(label, res.processed.receipt.cpu_usage_us)
+    } catch (error) {
+      metrics.rejected(label, error)
+      throw error
+    }
+  }
+
+  // sellers and buyers are busy until their flow ends, so their newest offer is the one of the flow
+  const latestOffer = async (table, scope, indexPosition, account) => {
+    const key = nameToBigInt(account) << 64n
+    const res = await rpc.get_table_rows({
+      code: escrow,
+      scope,
+      table,
+      json: true,
+      index_position: indexPosition,
+      key_type: 'i128',
+      lower_bound: key.toString(),
+      upper_bound: (key + 0xffffffffffffffffn).toString(),
+      reverse: true,
+      limit: 1
+    })
+    return res.rows[0].id
+  }
+
+  const compactSteps = { accptbuyoffr: 'accptbuyoff2', payoffer: 'payoffer2', confrmpaymnt: 'confrmpaymn2', addoffermsg: 'addoffermsg2' }
+  const step = name => config.compactActions ? compactSteps[name] : name
+
+  const trade = async (flow, seller, buyer) => {
+    await push('transfer', { from: seller, to: escrow, quantity: config.quantity }, seller, seedsContracts.token)
+    await push('addselloffer', { seller, total_offered: config.quantity, price_percentage: 10000 }, seller)
+    const sellOfferId = await latestOffer('selloffers', 'open', 2, seller)
+
+    await push('addbuyoffer', { buyer, sell_offer_id: sellOfferId, quantity: config.quantity, payment_method: 'paypal' }, buyer)
+    const buyOfferId = await latestOffer('buyoffers', 'open', 3, buyer)
+
+    await push(step('accptbuyoffr'), { buy_offer_id: buyOfferId }, seller)
+
+    if (flow === 'messages') {
+      const message = { buy_offer_id: buyOfferId, iv: 'iv', ephem_key: 'key', message: 'message', mac: '00'.repeat(32) }
+      await push(step('addoffermsg'), message, buyer)
+      await push(step('addoffermsg'), message, seller)
+    }
+
+    await push(step('payoffer'), { buy_offer_id: buyOfferId }, buyer)
+
+    if (flow === 'arbitration') {
+      const arbiter = arbiters[Math.floor(Math.random() * arbiters.length)]
+      await sleep(1000)
+      await push('initarbitrage', { buy_offer_id: buyOfferId }, buyer)
+      await push('arbtrgeoffer', { arbiter, offer_id: buyOfferId }, arbiter)
+      await push(Math.random() < 0.5 ? 'resolvesellr' : 'resolvebuyer', { offer_id: buyOfferId, notes: '' }, arbiter)
+      return
+    }
+
+    await push(step('confrmpaymnt'), { buy_offer_id: buyOfferId }, seller)
+  }
+
+  const pickFlow = () => {
+    const total = Object.values(config.mix).reduce((sum, weight) => sum + weight, 0)
+    let pick = Math.random() * total
+    for (const [flow, weight] of Object.entries(config.mix)) {
+      pick -= weight
+      if (pick < 0) return flow
+    }
+    return 'trade'
+  }
+
+  const idle = [...traders]
+  const running = new Set()
+  const deadline = Date.now() + config.durationSeconds * 1000
+  let nextReport = Date.now() + config.reportSeconds * 1000
+  let firstOverLimit = null
+
+  console.log('run flows')
+  while (Date.now() < deadline || running.size > 0) {
+    while (Date.now() < deadline && running.size < config.concurrency && idle.length >= 2) {
+      const seller = idle.splice(Math.floor(Math.random() * idle.length), 1)[0]
+      const buyer = idle.splice(Math.floor(Math.random() * idle.length), 1)[0]
+
+      // a rejected step ends the flow, it is already counted by push
+      const flow = trade(pickFlow(), seller, buyer)
+        .catch(() => {})
+        .then(() => {
+          running.delete(flow)
+          idle.push(seller, buyer)
+        })
+      running.add(flow)
+    }
+
+    await Promise.race([...running, sleep(100)])
+
+    if (Date.now() >= nextReport) {
+      const summary = await metrics.close(config)
+      console.log(JSON.stringify(summary))
+      if (!firstOverLimit && summary.over_cpu_limit.length > 0) firstOverLimit = summary
+      nextReport = Date.now() + config.reportSeconds * 1000
+    }
+  }
+
+  await metrics.close(config)
+  await setParamsValue()
+
+  if (firstOverLimit) {
+    console.log(`p99 cpu went over ${config.cpuLimitUs} us at ${firstOverLimit.offers} offers for ${firstOverLimit.over_cpu_limit.join(', ')}`)
+  } else {
+    console.log(`p99 cpu stayed under ${config.cpuLimitUs} us`)
+  }
+
+  if (reportPath) {
+    fs.writeFileSync(reportPath, JSON.stringify({ config, windows: metrics.windows, first_over_cpu_limit: firstOverLimit }, null, 2))
+    console.log(`report written to ${reportPath}`)
+  }
+}
+
+main().catch(error => {
+  console.error(error)
+  process.exit(1)
+})
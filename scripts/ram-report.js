@@ -0,0 +1,208 @@
+// RAM footprint of the escrow tables and a projection for a workload mix.
+//
+//   node scripts/ram-report.js [workload.json] [--json]
+//
+// Row sizes are averaged over the rows found on the node, a table without rows is
+// sized with a row built from the ABI. Secondary indexes are read from the headers,
+// the ABI does not list them.
+
+const fs = require('fs')
+const { join } = require('path')
+const { Serialize } = require('eosjs')
+const { rpc } = require('./eos')
+const { contractNames } = require('./config')
+
+const { escrow } = contractNames
+
+// billable sizes of nodeos chainbase objects (chain/config.hpp)
+const rowOverhead = 108
+const tableOverhead = 108
+const indexOverhead = {
+  uint64_t: 128,
+  uint128_t: 136,
+  checksum256: 152,
+  double: 128,
+  'long double': 144
+}
+
+const headerFiles = [
+  join(__dirname, '../include/escrow.hpp'),
+  join(__dirname, '../include/config.hpp'),
+  join(__dirname, '../include/tables/users.hpp')
+]
+
+const defaultWorkload = {
+  users: 1000,
+  sellOffersPerUser: 2,
+  buyOffersPerSellOffer: 3,
+  messagesPerBuyOffer: 4,
+  arbitrationRate: 0.01,
+  hashOnlyMessages: false,
+  // length of strings and number of items of vectors in rows built from the ABI
+  stringBytes: 32,
+  vectorItems: 1
+}
+
+const sampleRows = 100
+
+// key types of the secondary indexes of each multi_index table
+function getSecondaryIndexes () {
+  const indexes = {}
+
+  for (const file of headerFiles) {
+    const source = fs.readFileSync(file, 'utf8')
+    const tableRegex = /multi_index<\s*(?:name\("([\w.]+)"\)|"([\w.]+)"_n)/g
+    let match
+
+    while ((match = tableRegex.exec(source)) !== null) {
+      const table = match[1] || match[2]
+      const definition = source.slice(match.index, source.indexOf(';', match.index))
+      const keyTypes = [...definition.matchAll(/const_mem_fun<\s*\w+\s*,\s*((?:eosio::)?[\w ]+?)\s*,/g)]
+        .map(([, keyType]) => keyType.replace('eosio::', ''))
+
+      indexes[table] = keyTypes
+    }
+  }
+
+  return indexes
+}
+
+function sampleValue (type, abi, workload) {
+  if (type.arrayOf) return Array.from({ length: workload.vectorItems }, () => sampleValue(type.arrayOf, abi, workload))
+  if (type.optionalOf) return sampleValue(type.optionalOf, abi, workload)
+
+  const variant = abi.variants.find(({ name }) => name === type.name)
+  if (variant) return [variant.types[0], sampleValue(type.fields[0].type, abi, workload)]
+
+  if (type.base || type.fields.length) {
+    const value = type.base ? sampleValue(type.base, abi, workload) : {}
+    for (const field of type.fields) {
+      value[field.name] = sampleValue(field.type, abi, workload)
+    }
+    return value
+  }
+
+  switch (type.name) {
+    case 'bool': return false
+    case 'string': return 'x'.repeat(workload.stringBytes)
+    case 'bytes': return '00'.repeat(workload.stringBytes)
+    case 'name': return escrow
+    case 'asset': return '0.0000 SEEDS'
+    case 'symbol': return '4,SEEDS'
+    case 'checksum256': return '00'.repeat(32)
+    case 'time_point':
+    case 'time_point_sec': return '2021-01-01T00:00:00.000'
+    case 'public_key': return 'PUB_K1_6utVJ2S4zHZCiJvTxDhRVUst5RM5zB8foUaCEqEw34dz9wFh5v'
+    default: return 0
+  }
+}
+
+function serializedSize (type, value) {
+  const buffer = new Serialize.SerialBuffer()
+  type.serialize(buffer, value)
+  return buffer.asUint8Array().length
+}
+
+async function getScopes (table) {
+  const scopes = []
+  let lowerBound = ''
+  let more = true
+
+  while (more) {
+    const res = await rpc.get_table_by_scope({ code: escrow, table, lower_bound: lowerBound, limit: 100 })
+    scopes.push(...res.rows)
+    more = res.more !== ''
+    lowerBound = res.more
+  }
+
+  return scopes
+}
+
+async function measureTable (table, type, secondaryIndexes, abi, workload) {
+  const scopes = await getScopes(table)
+  const rows = scopes.reduce((total, { count }) => total + count, 0)
+
+  const sizes = []
+  for (const { scope } of scopes) {
+    if (sizes.length >= sampleRows) break
+    const res = await rpc.get_table_rows({ code: escrow, scope, table, json: false, limit: sampleRows - sizes.length })
+    sizes.push(...res.rows.map(row => row.length / 2))
+  }
+
+  const measured = sizes.length > 0
+  const dataBytes = measured
+    ? Math.round(sizes.reduce((total, size) => total + size, 0) / sizes.length)
+    : serializedSize(type, sampleValue(type, abi, workload))
+
+  const indexBytes = secondaryIndexes.reduce((total, keyType) => total + indexOverhead[keyType], 0)
+
+  return {
+    table,
+    source: measured ? 'node' : 'abi',
+    data_bytes: dataBytes,
+    secondary_indexes: secondaryIndexes.length,
+    row_bytes: dataBytes + rowOverhead + indexBytes,
+    scopes: scopes.length,
+    rows,
+    total_bytes: rows * (dataBytes + rowOverhead + indexBytes) + scopes.length * tableOverhead * (1 + secondaryIndexes.length)
+  }
+}
+
+function projectWorkload (tables, workload) {
+  const rowBytes = table => tables[table] ? tables[table].row_bytes : 0
+
+  const sellOffers = workload.users * workload.sellOffersPerUser
+  const buyOffers = sellOffers * workload.buyOffersPerSellOffer
+  const messageTable = workload.hashOnlyMessages ? 'msganchors' : 'pmessages'
+
+  const perUser = rowBytes('users') + rowBytes('ledger') + rowBytes('userspkeys') + rowBytes('seedsstatus')
+  const perSellOffer = rowBytes('selloffers')
+  const perBuyOffer = rowBytes('buyoffers') + rowBytes('buysellrel') +
+    workload.messagesPerBuyOffer * rowBytes(messageTable) +
+    workload.arbitrationRate * rowBytes('arbitoffs')
+
+  const fixed = Object.values(tables).reduce((total, table) =>
+    total + Math.max(table.scopes, 1) * tableOverhead * (1 + table.secondary_indexes), 0)
+
+  return {
+    per_user_bytes: perUser,
+    per_sell_offer_bytes: perSellOffer,
+    per_buy_offer_bytes: Math.round(perBuyOffer),
+    users_bytes: workload.users * perUser,
+    sell_offers_bytes: sellOffers * perSellOffer,
+    buy_offers_bytes: Math.round(buyOffers * perBuyOffer),
+    fixed_bytes: fixed,
+    total_bytes: Math.round(workload.users * perUser + sellOffers * perSellOffer + buyOffers * perBuyOffer + fixed)
+  }
+}
+
+async function main () {
+  const args = process.argv.slice(2)
+  const workloadFile = args.find(arg => !arg.startsWith('--'))
+  const workload = { ...defaultWorkload, ...(workloadFile ? JSON.parse(fs.readFileSync(workloadFile)) : {}) }
+
+  const { abi } = await rpc.get_abi(escrow)
+  const types = Serialize.getTypesFromAbi(Serialize.createInitialTypes(), abi)
+  const secondaryIndexes = getSecondaryIndexes()
+
+  const tables = {}
+  for (const { name, type } of abi.tables) {
+    tables[name] = await measureTable(name, types.get(type), secondaryIndexes[name] || [], abi, workload)
+  }
+
+  const projection = projectWorkload(tables, workload)
+
+  if (args.includes('--json')) {
+    console.log(JSON.stringify({ workload, tables: Object.values(tables), projection }, null, 2))
+    return
+  }
+
+  console.table(Object.values(tables))
+  console.log('workload', workload)
+  console.table(projection)
+}
+
+main().catch(error => {
+  console.error(error)
+  process.exit(1)
+})
@@ -5,83 +5,317 @@ ACTION escrow::reset()
 {
   require_auth(get_self());
 
-  user_tables users_t(get_self(), get_self().value);
-  auto uitr = users_t.begin();
-  while(uitr != users_t.end())
+  for (const auto & [table, scope] : get_reset_plan(false))
   {
-    uitr = users_t.erase(uitr);
+    erase_table_rows(table, scope, std::numeric_limits<uint64_t>::max());
   }
 
-  balances_tables balances_t(get_self(), get_self().value);
-  auto bitr = balances_t.begin();
-  while(bitr != balances_t.end())
-  {
-    bitr = balances_t.erase(bitr);
-  }
+  reset_state_tables reset_state_t(get_self(), get_self().value);
+  reset_state_t.remove();
+}
 
-  transactions_stats_tables trx_stats_t(get_self(), get_self().value);
-  auto titr = trx_stats_t.begin();
-  while(titr != trx_stats_t.end())
-  {
-    titr = trx_stats_t.erase(titr);
-  }
+ACTION escrow::resetoffers()
+{
+  require_auth(get_self());
 
-  offer_tables offers_t(get_self(), get_self().value);
-  auto oitr = offers_t.begin();
-  while(oitr != offers_t.end())
+  for (const auto & [table, scope] : get_reset_plan(true))
   {
-    oitr = offers_t.erase(oitr);
+    erase_table_rows(table, scope, std::numeric_limits<uint64_t>::max());
   }
+}
 
-  buy_sell_relation_tables buy_sell_t(get_self(), get_self().value);
-  auto bsritr = buy_sell_t.begin();
-  while(bsritr != buy_sell_t.end())
-  {
-    bsritr = buy_sell_t.erase(bsritr);
-  }
+ACTION escrow::resetchunk(const uint64_t & max_rows, const bool & offers_only)
+{
+  require_auth(get_self());
 
-  arbitrage_tables arbitrage_offers_t(get_self(), get_self().value);
-  auto aritr = arbitrage_offers_t.begin();
-  while(aritr != arbitrage_offers_t.end())
-  {
-    aritr = arbitrage_offers_t.erase(aritr);
-  }
+  check(max_rows > 0, "max_rows must be greater than 0");
+
+  reset_state_tables reset_state_t(get_self(), get_self().value);
+  reset_state_table state = reset_state_t.get_or_default(reset_state_table{ 0, 0, offers_only, name(), name() });
+  check(state.offers_only == offers_only, "a reset with a different offers_only value is in progress");
+
+  auto plan = get_reset_plan(offers_only);
+  uint64_t budget = max_rows;
 
-  private_message_tables pmessages_t(get_self(), get_self().value);
-  auto pmitr = pmessages_t.begin();
-  while(pmitr != pmessages_t.end())
+  while (state.step < plan.size() && budget > 0)
   {
-    pmitr = pmessages_t.erase(pmitr);
+    auto [table, scope] = plan[state.step];
+    uint64_t erased = erase_table_rows(table, scope, budget);
+
+    state.rows_erased += erased;
+    budget -= erased;
+
+    // budget left over means the table was emptied
+    if (budget > 0) state.step++;
   }
 
-  user_public_key_tables public_t(get_self(), get_self().value);
-  auto pitr = public_t.begin();
-  while (pitr != public_t.end())
+  if (state.step >= plan.size())
   {
-    pitr = public_t.erase(pitr);
+    reset_state_t.remove();
+    print("reset completed, ", state.rows_erased, " rows erased");
+    return;
   }
-  
+
+  state.table = plan[state.step].first;
+  state.scope = plan[state.step].second;
+  reset_state_t.set(state, _self);
+
+  print("reset in progress, table ", state.table, " scope ", state.scope,
+    ", step ", state.step + 1, " of ", plan.size(), ", ", state.rows_erased, " rows erased");
 }
 
-ACTION escrow::resetoffers()
+ACTION escrow::migrateoffrs(const uint64_t & max_rows)
 {
   require_auth(get_self());
 
   offer_tables offers_t(get_self(), get_self().value);
+
+  offer_ids_tables offer_ids_t(get_self(), get_self().value);
+  offer_ids_table offer_ids = offer_ids_t.get_or_default(offer_ids_table{ 0 });
+
+  uint64_t migrated = 0;
   auto oitr = offers_t.begin();
-  while(oitr != offers_t.end())
+
+  while (oitr != offers_t.end() && migrated < max_rows)
   {
+    auto get_quantity = [&](const name & key) {
+      auto qitr = oitr->quantity_info.find(key);
+      return qitr != oitr->quantity_info.end() ? qitr->second : asset(0, util::seeds_symbol);
+    };
+    auto get_price = [&](const name & key) {
+      auto pitr = oitr->price_info.find(key);
+      return pitr != oitr->price_info.end() ? pitr->second : 0;
+    };
+
+    name partition = get_offer_partition(oitr->current_status);
+
+    if (oitr->type == offer_type_sell)
+    {
+      sell_offer_tables selloffers_t(get_self(), partition.value);
+      auto sitr = selloffers_t.emplace(_self, [&](auto & offer){
+        offer.id = oitr->id;
+        offer.seller = oitr->seller;
+        offer.total_offered = get_quantity(name("totaloffered"));
+        offer.available = get_quantity(name("available"));
+        offer.price_percentage = get_price(name("priceper"));
+        offer.seeds_per_usd = get_price(name("seedsperusd"));
+        offer.created_date = oitr->created_date;
+        for (auto & status : oitr->status_history)
+        {
+          offer.status_history.set(get_status_index(offer, status.first), status.second);
+        }
+        offer.payment_methods = oitr->payment_methods;
+        offer.current_status = oitr->current_status;
+        offer.time_zone = oitr->time_zone;
+        offer.fiat_currency = oitr->fiat_currency;
+        offer.sold = asset(0, util::seeds_symbol);
+        offer.open_buy_offers = 0;
+      });
+
+      update_market_filters(*sitr, partition);
+    }
+    else
+    {
+      buy_offer_tables buyoffers_t(get_self(), partition.value);
+      buyoffers_t.emplace(_self, [&](auto & offer){
+        offer.id = oitr->id;
+        offer.sell_id = oitr->sell_id;
+        offer.seller = oitr->seller;
+        offer.buyer = oitr->buyer;
+        offer.quantity = get_quantity(name("buyquantity"));
+        offer.price_percentage = get_price(name("priceper"));
+        offer.seeds_per_usd = get_price(name("seedsperusd"));
+        offer.created_date = oitr->created_date;
+        for (auto & status : oitr->status_history)
+        {
+          offer.status_history.set(get_status_index(offer, status.first), status.second);
+        }
+        offer.payment_method = oitr->payment_methods.empty() ? string("") : oitr->payment_methods.begin()->first;
+        offer.current_status = oitr->current_status;
+        offer.fiat_currency = oitr->fiat_currency;
+      });
+
+      // legacy ids are sequential, so the sell offer has already been migrated
+      name sell_partition = find_offer_partition<sell_offer_tables>(oitr->sell_id);
+      if (sell_partition != name())
+      {
+        sell_offer_tables selloffers_t(get_self(), sell_partition.value);
+        selloffers_t.modify(selloffers_t.find(oitr->sell_id), _self, [&](auto & selloffer){
+          if (partition == offer_partition_terminal)
+          {
+            if (oitr->current_status == buy_offer_status_successful) selloffer.sold += get_quantity(name("buyquantity"));
+          }
+          else
+          {
+            selloffer.open_buy_offers += 1;
+          }
+        });
+      }
+    }
+
+    offer_ids.next_id = std::max(offer_ids.next_id, oitr->id + 1);
     oitr = offers_t.erase(oitr);
+    migrated++;
+  }
+
+  offer_ids_t.set(offer_ids, _self);
+}
+
+#ifdef LOCAL_TEST
+// Writes a row with the legacy offers layout, so an upgrade can be rehearsed on a test node.
+ACTION escrow::addlgcyoffer(
+  const uint64_t & id,
+  const uint64_t & sell_id,
+  const name & seller,
+  const name & buyer,
+  const name & type,
+  const asset & quantity,
+  const uint64_t & price_percentage,
+  const name & current_status
+)
+{
+  require_auth(get_self());
+
+  user_tables users_t(get_self(), get_self().value);
+  auto uitr = users_t.find(seller.value);
+  check(uitr != users_t.end(), "user not found");
+
+  offer_tables offers_t(get_self(), get_self().value);
+  check(offers_t.find(id) == offers_t.end(), "offer already exists");
+
+  offers_t.emplace(_self, [&](auto & offer){
+    offer.id = id;
+    offer.sell_id = sell_id;
+    offer.seller = seller;
+    offer.buyer = buyer;
+    offer.type = type;
+    if (type == offer_type_sell)
+    {
+      offer.quantity_info.insert(std::make_pair(name("totaloffered"), quantity));
+      offer.quantity_info.insert(std::make_pair(name("available"), quantity));
+    }
+    else
+    {
+      offer.quantity_info.insert(std::make_pair(name("buyquantity"), quantity));
+    }
+    offer.price_info.insert(std::make_pair(name("priceper"), price_percentage));
+    offer.price_info.insert(std::make_pair(name("seedsperusd"), get_seeds_per_usd().amount * price_percentage));
+    offer.created_date = current_time_point();
+    offer.status_history.insert(std::make_pair(current_status, current_time_point()));
+    offer.payment_methods = uitr->payment_methods;
+    offer.current_status = current_status;
+    offer.time_zone = uitr->time_zone;
+    offer.fiat_currency = uitr->fiat_currency;
+  });
+}
+#endif
+
+// Merges the balances and trxstats rows of each account into one ledger row. An account
+// that deposited or traded since the upgrade already has a ledger row, the legacy amounts
+// and counters are added to it.
+ACTION escrow::migrateldgr(const uint64_t & max_rows)
+{
+  require_auth(get_self());
+
+  balances_tables balances_t(get_self(), get_self().value);
+  transactions_stats_tables trx_stats_t(get_self(), get_self().value);
+  ledger_tables ledger_t(get_self(), get_self().value);
+
+  auto merge = [&](const name & account, const balances_table * balance, const transactions_stats_table * stats) {
+    int64_t available = balance ? balance->available_balance.amount : 0;
+    int64_t swap = balance ? balance->swap_balance.amount : 0;
+    int64_t escrowed = balance ? balance->escrow_balance.amount : 0;
+    uint32_t total_trx = stats ? stats->total_trx : 0;
+    uint32_t sell_successful = stats ? stats->sell_successful : 0;
+    uint32_t buy_successful = stats ? stats->buy_successful : 0;
+
+    auto litr = ledger_t.find(account.value);
+    if (litr != ledger_t.end())
+    {
+      ledger_t.modify(litr, _self, [&](auto & ledger){
+        ledger.available += available;
+        ledger.swap += swap;
+        ledger.escrow += escrowed;
+        ledger.total_trx += total_trx;
+        ledger.sell_successful += sell_successful;
+        ledger.buy_successful += buy_successful;
+      });
+    }
+    else
+    {
+      ledger_t.emplace(_self, [&](auto & ledger){
+        ledger.account = account;
+        ledger.available = available;
+        ledger.swap = swap;
+        ledger.escrow = escrowed;
+        ledger.total_trx = total_trx;
+        ledger.sell_successful = sell_successful;
+        ledger.buy_successful = buy_successful;
+      });
+    }
+  };
+
+  uint64_t migrated = 0;
+
+  auto titr = trx_stats_t.begin();
+  while (titr != trx_stats_t.end() && migrated < max_rows)
+  {
+    auto bitr = balances_t.find(titr->account.value);
+    bool has_balance = bitr != balances_t.end();
+
+    merge(titr->account, has_balance ? &*bitr : nullptr, &*titr);
+
+    if (has_balance) balances_t.erase(bitr);
+    titr = trx_stats_t.erase(titr);
+    migrated++;
   }
 
-  buy_sell_relation_tables buy_sell_t(get_self(), get_self().value);
-  auto bsritr = buy_sell_t.begin();
-  while(bsritr != buy_sell_t.end())
+  auto bitr = balances_t.begin();
+  while (bitr != balances_t.end() && migrated < max_rows)
   {
-    bsritr = buy_sell_t.erase(bsritr);
+    merge(bitr->account, &*bitr, nullptr);
+
+    bitr = balances_t.erase(bitr);
+    migrated++;
   }
 }
 
+#ifdef LOCAL_TEST
+// Writes legacy balances and trxstats rows for account, so an upgrade can be rehearsed
+// on a test node.
+ACTION escrow::addlgcybal(
+  const name & account,
+  const asset & available_balance,
+  const asset & swap_balance,
+  const asset & escrow_balance,
+  const uint64_t & sell_successful,
+  const uint64_t & buy_successful
+)
+{
+  require_auth(get_self());
+
+  balances_tables balances_t(get_self(), get_self().value);
+  check(balances_t.find(account.value) == balances_t.end(), "balance already exists");
+
+  balances_t.emplace(_self, [&](auto & balance){
+    balance.account = account;
+    balance.available_balance = available_balance;
+    balance.swap_balance = swap_balance;
+    balance.escrow_balance = escrow_balance;
+  });
+
+  transactions_stats_tables trx_stats_t(get_self(), get_self().value);
+  check(trx_stats_t.find(account.value) == trx_stats_t.end(), "transaction stats already exist");
+
+  trx_stats_t.emplace(_self, [&](auto & stats){
+    stats.account = account;
+    stats.total_trx = sell_successful + buy_successful;
+    stats.sell_successful = sell_successful;
+    stats.buy_successful = buy_successful;
+  });
+}
+#endif
+
 ACTION escrow::resetsttngs()
 {
 
@@ -92,10 +326,15 @@ ACTION escrow::resetsttngs()
   {
     citr = config.erase(citr);
   }
+
+  settings_tables settings_t(get_self(), get_self().value);
+  settings_t.remove();
 }
 
 ACTION escrow::setparam(name key, SettingsValues value, string description)
 {
+  require_auth(get_self());
+
   auto citr = config.find(key.value);
   if (citr == config.end())
   {
@@ -118,6 +357,14 @@ ACTION escrow::setparam(name key, SettingsValues value, string description)
       }
     });
   }
+
+  settings_tables settings_t(get_self(), get_self().value);
+  settings_table settings = settings_t.get_or_default(settings_table{});
+
+  if (set_setting(settings, key, value))
+  {
+    settings_t.set(settings, _self);
+  }
 }
 
 ACTION escrow::deposit(const name & from, const name & to, const asset & quantity, const std::string & memo)
@@ -128,27 +375,32 @@ ACTION escrow::deposit(const name & from, const name & to, const asset & quantit
     auto uitr = users_t.find(from.value);
     check(uitr != users_t.end(), "user not found");
 
-    util::check_seeds_user_status(from, util::seeds_resident_status);
+    check_seeds_user_status(from, util::seeds_resident_status);
     util::check_asset(quantity);
 
-    balances_tables balances_t(get_self(), get_self().value);
-    auto bitr = balances_t.find(from.value);
+    ledger_tables ledger_t(get_self(), get_self().value);
+    auto litr = ledger_t.find(from.value);
 
-    if(bitr != balances_t.end())
+    if(litr != ledger_t.end())
     {
-      balances_t.modify(bitr, _self, [&](auto & balance){
-        balance.available_balance += quantity;
+      ledger_t.modify(litr, _self, [&](auto & ledger){
+        ledger.available += quantity.amount;
       });
     }
     else
     {
-      balances_t.emplace(_self, [&](auto & balance){
-        balance.account = from;
-        balance.available_balance = quantity;
-        balance.swap_balance = asset(0, util::seeds_symbol);
-        balance.escrow_balance = asset(0, util::seeds_symbol);
+      ledger_t.emplace(_self, [&](auto & ledger){
+        ledger.account = from;
+        ledger.available = quantity.amount;
+        ledger.swap = 0;
+        ledger.escrow = 0;
+        ledger.total_trx = 0;
+        ledger.sell_successful = 0;
+        ledger.buy_successful = 0;
       });
     }
+
+    send_balance_event(from, quantity.amount, 0, 0);
   }
 }
 
@@ -158,16 +410,18 @@ ACTION escrow::withdraw(const name & account, const asset & quantity, const std:
 
   util::check_asset(quantity);
 
-  balances_tables balances_t(get_self(), get_self().value);
+  ledger_tables ledger_t(get_self(), get_self().value);
 
-  auto bitr = balances_t.find(account.value);
-  check(bitr != balances_t.end(), "balance not found");
-  check(bitr->available_balance >= quantity, "user does not have enough available balance");
+  auto litr = ledger_t.find(account.value);
+  check(litr != ledger_t.end(), "balance not found");
+  check(litr->available >= quantity.amount, "user does not have enough available balance");
 
-  balances_t.modify(bitr, _self, [&](auto & balance){
-    balance.available_balance -= quantity;
+  ledger_t.modify(litr, _self, [&](auto & ledger){
+    ledger.available -= quantity.amount;
   });
 
+  send_balance_event(account, -quantity.amount, 0, 0);
+
   send_transfer(account, quantity, std::string("withdraw"));
 }
 
@@ -182,7 +436,7 @@ ACTION escrow::upsertuser(
 {
   require_auth(account);
 
-  util::check_seeds_user_status(account, util::seeds_visitor_status);
+  check_seeds_user_status(account, util::seeds_visitor_status);
 
   user_tables users_t(get_self(), get_self().value);
   auto uitr = users_t.find(account.value);
@@ -207,14 +461,20 @@ ACTION escrow::upsertuser(
       item.is_arbiter = false;
     });
 
-    transactions_stats_tables trx_stats_t(get_self(), get_self().value);
+    ledger_tables ledger_t(get_self(), get_self().value);
 
-    trx_stats_t.emplace(_self, [&](auto & trxstats){
-      trxstats.account = account;
-      trxstats.total_trx = 0;
-      trxstats.sell_successful = 0;
-      trxstats.buy_successful = 0;
-    });
+    if (ledger_t.find(account.value) == ledger_t.end())
+    {
+      ledger_t.emplace(_self, [&](auto & ledger){
+        ledger.account = account;
+        ledger.available = 0;
+        ledger.swap = 0;
+        ledger.escrow = 0;
+        ledger.total_trx = 0;
+        ledger.sell_successful = 0;
+        ledger.buy_successful = 0;
+      });
+    }
   }
 }
 
@@ -244,130 +504,205 @@ ACTION escrow::addselloffer(const name & seller, const asset & total_offered, co
 {
   require_auth(seller);
 
-  util::check_seeds_user_status(seller, util::seeds_resident_status);
+  check_seeds_user_status(seller, util::seeds_resident_status);
   util::check_asset(total_offered);
 
-  balances_tables balances_t(get_self(), get_self().value);
+  ledger_tables ledger_t(get_self(), get_self().value);
 
-  auto bitr = balances_t.find(seller.value);
-  check(bitr != balances_t.end(), "user does not have a balance entry");
-  check(bitr->available_balance >= total_offered, "user does not have enough available balance to create the offer");
+  auto litr = ledger_t.find(seller.value);
+  check(litr != ledger_t.end(), "user does not have a balance entry");
+  check(litr->available >= total_offered.amount, "user does not have enough available balance to create the offer");
 
-  balances_t.modify(bitr, _self, [&](auto & balance){
-    balance.available_balance -= total_offered;
-    balance.swap_balance += total_offered;
+  ledger_t.modify(litr, _self, [&](auto & ledger){
+    ledger.available -= total_offered.amount;
+    ledger.swap += total_offered.amount;
   });
 
+  send_balance_event(seller, -total_offered.amount, total_offered.amount, 0);
+
   user_tables users_t(get_self(), get_self().value);
   auto uitr = users_t.get(seller.value, "user not found");
 
-  price_tables price(seeds::tlosto , seeds::tlosto.value);
-  price_table p = price.get();
-
-  asset current_price = p.current_seeds_per_usd;
+  asset current_price = get_seeds_per_usd();
   uint64_t seedsperusd = current_price.amount * price_percentage;
-  offer_tables offers_t(get_self(), get_self().value);
+  sell_offer_tables selloffers_t(get_self(), offer_partition_open.value);
 
-  offers_t.emplace(_self, [&](auto & offer){
-    uint64_t new_id = offers_t.available_primary_key();
-    offer.id = new_id;
-    offer.sell_id = new_id;
+  auto sitr = selloffers_t.emplace(_self, [&](auto & offer){
+    offer.id = get_next_offer_id();
     offer.seller = seller;
-    offer.buyer = name("");
-    offer.type = offer_type_sell;
-    offer.quantity_info = {
-      { name("totaloffered"), total_offered },
-      { name("available"), total_offered },
-    };
-    offer.price_info = {
-      { name("priceper"), price_percentage },
-      { name("seedsperusd"), seedsperusd }
-    };
+    offer.total_offered = total_offered;
+    offer.available = total_offered;
+    offer.price_percentage = price_percentage;
+    offer.seeds_per_usd = seedsperusd;
     offer.created_date = current_time_point();
-    offer.status_history.insert(std::make_pair(sell_offer_status_active, current_time_point()));
+    offer.status_history.set(get_status_index(offer, sell_offer_status_active), current_time_point());
     offer.current_status = sell_offer_status_active;
     offer.payment_methods = uitr.payment_methods;
     offer.time_zone = uitr.time_zone;
     offer.fiat_currency = uitr.fiat_currency;
+    offer.sold = asset(0, util::seeds_symbol);
+    offer.open_buy_offers = 0;
   });
+
+  update_market_filters(*sitr, offer_partition_open);
+  send_offer_event(*sitr, name());
 }
 
+// Cancels an active sell offer and rejects its first cancel_batch pending buy offers.
+// The rest stay pending until rejctpending cranks them, which anyone can call. Meanwhile
+// they can not be accepted as nothing is available, and no new buy offer fits either.
 ACTION escrow::cancelsoffer(const uint64_t & sell_offer_id, const std::string & memo)
 {
-  offer_tables offers_t(get_self(), get_self().value);
+  sell_offer_tables selloffers_t(get_self(), get_sell_offer_partition(sell_offer_id).value);
 
-  auto oitr = offers_t.find(sell_offer_id);
-  check(oitr != offers_t.end(), "sell offer not found");
-  check(oitr->type == offer_type_sell, "offer is not a sell offer");
+  auto oitr = selloffers_t.find(sell_offer_id);
 
   name seller = oitr->seller;
 
   require_auth(seller);
 
-  balances_tables balances_t(get_self(), get_self().value);
-  auto bitr = balances_t.find(seller.value);
-  check(bitr != balances_t.end(), "user balance not found");
+  check(oitr->current_status == sell_offer_status_active, "can not cancel the sell offer, it is not active");
+
+  ledger_tables ledger_t(get_self(), get_self().value);
+  auto litr = ledger_t.find(seller.value);
+  check(litr != ledger_t.end(), "user balance not found");
 
-  auto quantity_info = oitr->quantity_info;
-  auto available = quantity_info.find(name("available"));
+  asset available = oitr->available;
 
-  balances_t.modify(bitr, _self, [&](auto & balance){
-    balance.swap_balance -= available->second;
-    balance.available_balance += available->second;
+  ledger_t.modify(litr, _self, [&](auto & ledger){
+    ledger.swap -= available.amount;
+    ledger.available += available.amount;
   });
 
-  offers_t.modify(oitr, _self, [&](auto & offer){
-    offer.status_history.insert(std::make_pair(sell_offer_status_canceled, current_time_point()));
-    offer.current_status = sell_offer_status_canceled;
-    offer.quantity_info.at(name("available")) = asset(0, util::seeds_symbol);
+  send_balance_event(seller, available.amount, -available.amount, 0);
+
+  update_offer_status(selloffers_t, oitr, sell_offer_status_canceled, [&](auto & offer){
+    offer.available = asset(0, util::seeds_symbol);
   });
 
-  auto offersby_sell_id = offers_t.get_index<name("bysellid")>();
-  auto obsitr = offersby_sell_id.lower_bound(uint128_t(sell_offer_id) << 64);
+  reject_pending_buy_offers(sell_offer_id, get_settings().cancel_batch);
+}
 
-  while (obsitr != offersby_sell_id.end() && obsitr->sell_id == sell_offer_id) {
-    if (obsitr->type == offer_type_buy)
-      rejctbuyoffr(obsitr->id, std::string(""));
-    obsitr++;
-  }
+ACTION escrow::rejctpending(const uint64_t & sell_offer_id)
+{
+  sell_offer_tables selloffers_t(get_self(), get_sell_offer_partition(sell_offer_id).value);
+
+  auto oitr = selloffers_t.find(sell_offer_id);
+  check(oitr->current_status == sell_offer_status_canceled, "sell offer is not canceled");
+
+  uint64_t rejected = reject_pending_buy_offers(sell_offer_id, get_settings().cancel_batch);
+  check(rejected > 0, "sell offer has no pending buy offers");
 }
 
 ACTION escrow::addbuyoffer(const name & buyer, const uint64_t & sell_offer_id, const asset & quantity, const std::string & payment_method, const std::string & memo)
 {
   require_auth(buyer);
 
-  util::check_seeds_user_status(buyer, util::seeds_visitor_status);
+  check_seeds_user_status(buyer, util::seeds_visitor_status);
   util::check_asset(quantity);
 
   user_tables users_t(get_self(), get_self().value);
   auto uitr = users_t.get(buyer.value, "user not found");
 
-  offer_tables offers_t(get_self(), get_self().value);
-  auto sitr = offers_t.get(sell_offer_id, "sell offer not found");
+  sell_offer_tables selloffers_t(get_self(), get_sell_offer_partition(sell_offer_id).value);
+  auto sitr = selloffers_t.find(sell_offer_id);
+
+  check(sitr->available >= quantity, "sell offer does not have enough funds");
+  check(sitr->seller != buyer, "can not propose a buy offer for your own sell offer");
 
-  check(sitr.type == offer_type_sell, "offer is not a sell offer");
-  check(sitr.quantity_info[name("available")] >= quantity, "sell offer does not have enough funds");
-  check(sitr.seller != buyer, "can not propose a buy offer for your own sell offer");
+  auto allowed_payment_method = sitr->payment_methods.find(payment_method);
+  check(allowed_payment_method != sitr->payment_methods.end(), "payment method is not allowed");
 
-  auto allowed_payment_method = sitr.payment_methods.find(payment_method);
-  check(allowed_payment_method != sitr.payment_methods.end(), "payment method is not allowed");
+  add_buy_offer(buyer, selloffers_t, sitr, quantity, payment_method);
+}
 
-  uint64_t id = offers_t.available_primary_key();
+// Fills quantity from the cheapest active sell offers in fiat_currency, one buy offer
+// per sell offer, stopping at max_price_percentage, after max_matches buy offers or
+// after visiting max_query_scan sell offers, skipped ones included.
+ACTION escrow::marketbuy(
+  const name & buyer,
+  const asset & quantity,
+  const name & fiat_currency,
+  const std::string & payment_method,
+  const uint64_t & max_price_percentage,
+  const uint64_t & max_matches,
+  const std::string & memo
+)
+{
+  require_auth(buyer);
 
-  offers_t.emplace(_self, [&](auto & offer){
+  check_seeds_user_status(buyer, util::seeds_visitor_status);
+  util::check_asset(quantity);
+  check(max_matches > 0, "max_matches must be greater than 0");
+
+  user_tables users_t(get_self(), get_self().value);
+  auto uitr = users_t.get(buyer.value, "user not found");
+
+  // the open partition only holds active sell offers, so this is the order book of fiat_currency
+  sell_offer_tables selloffers_t(get_self(), offer_partition_open.value);
+  auto selloffers_by_price = selloffers_t.get_index<name("bycurprice")>();
+
+  asset remaining = quantity;
+  uint64_t matches = 0;
+  uint64_t scanned = 0;
+
+  auto sitr = selloffers_by_price.lower_bound(uint128_t(fiat_currency.value) << 64);
+  auto send = selloffers_by_price.upper_bound((uint128_t(fiat_currency.value) << 64) + max_price_percentage);
+
+  while (sitr != send && remaining.amount > 0 && matches < max_matches && scanned < max_query_scan)
+  {
+    scanned++;
+
+    if (sitr->seller == buyer ||
+      sitr->available.amount == 0 ||
+      sitr->payment_methods.find(payment_method) == sitr->payment_methods.end())
+    {
+      sitr++;
+      continue;
+    }
+
+    asset fill = std::min(sitr->available, remaining);
+    add_buy_offer(buyer, selloffers_t, selloffers_t.iterator_to(*sitr), fill, payment_method);
+
+    remaining -= fill;
+    matches++;
+    sitr++;
+  }
+
+  check(matches > 0, "no sell offer matches the market buy");
+}
+
+uint64_t escrow::add_buy_offer(
+  const name & buyer,
+  sell_offer_tables & selloffers_t,
+  sell_offer_tables::const_iterator sitr,
+  const asset & quantity,
+  const std::string & payment_method
+)
+{
+  uint64_t sell_offer_id = sitr->id;
+  uint64_t id = get_next_offer_id();
+  buy_offer_tables buyoffers_t(get_self(), offer_partition_open.value);
+
+  auto bitr = buyoffers_t.emplace(_self, [&](auto & offer){
     offer.id = id;
     offer.sell_id = sell_offer_id;
-    offer.seller = sitr.seller;
+    offer.seller = sitr->seller;
     offer.buyer = buyer;
-    offer.type = offer_type_buy;
-    offer.quantity_info.insert(std::make_pair(name("buyquantity"), quantity));
-    offer.price_info = sitr.price_info;
+    offer.quantity = quantity;
+    offer.price_percentage = sitr->price_percentage;
+    offer.seeds_per_usd = sitr->seeds_per_usd;
     offer.created_date = current_time_point();
-    offer.status_history.insert(std::make_pair(buy_offer_status_pending, current_time_point()));
-    offer.payment_methods.insert(*allowed_payment_method);
+    offer.status_history.set(get_status_index(offer, buy_offer_status_pending), current_time_point());
+    offer.payment_method = payment_method;
     offer.current_status = buy_offer_status_pending;
-    offer.time_zone = sitr.time_zone;
-    offer.fiat_currency = sitr.fiat_currency;
+    offer.fiat_currency = sitr->fiat_currency;
+  });
+
+  send_offer_event(*bitr, name());
+
+  selloffers_t.modify(sitr, _self, [&](auto & selloffer){
+    selloffer.open_buy_offers += 1;
   });
 
   buy_sell_relation_tables buysellrel_t(get_self(), get_self().value);
@@ -377,20 +712,20 @@ ACTION escrow::addbuyoffer(const name & buyer, const uint64_t & sell_offer_id, c
     rel.sell_offer_id = sell_offer_id;
     rel.buy_offer_id = id;
   });
+
+  return id;
 }
 
 ACTION escrow::delbuyoffer(const uint64_t & buy_offer_id, const std::string & memo)
 {
-  offer_tables offers_t(get_self(), get_self().value);
+  buy_offer_tables buyoffers_t(get_self(), get_buy_offer_partition(buy_offer_id).value);
 
-  auto bitr = offers_t.find(buy_offer_id);
-  check(bitr != offers_t.end(), "buy offer not found");
-  check(bitr->type == offer_type_buy, "offer is not a buy offer");
+  auto bitr = buyoffers_t.find(buy_offer_id);
   check(bitr->current_status == buy_offer_status_pending, "can not delete offer, status is not pending");
 
   require_auth(bitr->buyer);
 
-  uint64_t max_seller_time = config_get_uint64(name("b.accpt.lim"));
+  uint64_t max_seller_time = get_settings().accept_limit;
   uint64_t cutoff = current_time_point().sec_since_epoch() - max_seller_time;
   check(bitr->created_date.sec_since_epoch() < cutoff, "can not delete offer, it is too early");
 
@@ -404,102 +739,78 @@ ACTION escrow::delbuyoffer(const uint64_t & buy_offer_id, const std::string & me
     buysellrel_by_buy.erase(bsritr);
   }
 
-  offers_t.erase(bitr);
+  uint64_t sell_id = bitr->sell_id;
+  send_offer_event(bitr->id, sell_id, bitr->current_status, name(), bitr->quantity);
+  buyoffers_t.erase(bitr);
+
+  close_buy_offers(sell_id, 1, asset(0, util::seeds_symbol));
 }
 
 ACTION escrow::accptbuyoffr(const uint64_t & buy_offer_id, const std::string & memo)
 {
-  offer_tables offers_t(get_self(), get_self().value);
+  buy_offer_tables buyoffers_t(get_self(), get_buy_offer_partition(buy_offer_id).value);
 
-  auto boitr = offers_t.find(buy_offer_id);
-  check(boitr != offers_t.end(), "buy offer not found");
-  check(boitr->type == offer_type_buy, "offer is not a buy offer");
+  auto boitr = buyoffers_t.find(buy_offer_id);
   check(boitr->current_status == buy_offer_status_pending, "can not accept this buy offer, it's status is not pending");
 
   name seller = boitr->seller;
-  asset quantity = boitr->quantity_info.find(name("buyquantity"))->second;
+  asset quantity = boitr->quantity;
+  uint64_t sell_id = boitr->sell_id;
 
   require_auth(seller);
 
-  offers_t.modify(boitr, _self, [&](auto & buyoffer){
-    buyoffer.status_history.insert(std::make_pair(buy_offer_status_accepted, current_time_point()));
-    buyoffer.current_status = buy_offer_status_accepted;
-  });
-
-  buy_sell_relation_tables buysellrel_t(get_self(), get_self().value);
+  update_offer_status(buyoffers_t, boitr, buy_offer_status_accepted);
 
-  auto buysellrel_by_buy = buysellrel_t.get_index<name("bybuy")>();
-  auto bsritr = buysellrel_by_buy.get(buy_offer_id, "buy offer id relation not found");
+  take_from_sell_offer(sell_id, quantity);
 
-  auto sitr = offers_t.find(bsritr.sell_offer_id);
-  check(sitr != offers_t.end(), "sell offer not found");
+  ledger_tables ledger_t(get_self(), get_self().value);
 
-  asset available = sitr->quantity_info.find(name("available"))->second;
-  check(available >= quantity, "sell offer does not have enough funds");
+  auto litr = ledger_t.find(seller.value);
+  check(litr != ledger_t.end(), "seller balance not found");
 
-  offers_t.modify(sitr, _self, [&](auto & selloffer){
-    selloffer.quantity_info.at(name("available")) = available - quantity;
-    available = selloffer.quantity_info.at(name("available"));
-    if(available.amount == 0) {
-      selloffer.current_status = sell_offer_status_soldout;
-      selloffer.status_history.insert(std::make_pair(sell_offer_status_soldout, current_time_point()));
-    }
+  ledger_t.modify(litr, _self, [&](auto & ledger){
+    ledger.swap -= quantity.amount;
+    ledger.escrow += quantity.amount;
   });
 
-  balances_tables balances_t(get_self(), get_self().value);
-
-  auto bitr = balances_t.find(seller.value);
-  check(bitr != balances_t.end(), "seller balance not found");
-
-  balances_t.modify(bitr, _self, [&](auto & balance){
-    balance.swap_balance -= quantity;
-    balance.escrow_balance += quantity;
-  });
+  send_balance_event(seller, 0, -quantity.amount, quantity.amount);
 }
 
 ACTION escrow::rejctbuyoffr(const uint64_t & buy_offer_id, const std::string & memo) 
 {
 
-  offer_tables offers_t(get_self(), get_self().value); 
+  buy_offer_tables buyoffers_t(get_self(), get_buy_offer_partition(buy_offer_id).value);
 
-  auto boitr = offers_t.find(buy_offer_id);
-  check(boitr != offers_t.end(), "buy offer not found");
-  check(boitr->type == offer_type_buy, "offer is not a buy offer");
+  auto boitr = buyoffers_t.find(buy_offer_id);
   check(boitr->current_status == buy_offer_status_pending, "can not reject this buy offer, it's status is not pending");
 
   require_auth(boitr->seller);
-  
-  offers_t.modify(boitr, _self, [&](auto & buyoffer){
-    buyoffer.status_history.insert(std::make_pair(buy_offer_status_rejected, current_time_point()));
-    buyoffer.current_status = buy_offer_status_rejected;
-  });
+
+  uint64_t sell_id = boitr->sell_id;
+  update_offer_status(buyoffers_t, boitr, buy_offer_status_rejected);
+
+  close_buy_offers(sell_id, 1, asset(0, util::seeds_symbol));
 
 } 
 
 ACTION escrow::payoffer(const uint64_t & buy_offer_id, const std::string & memo)
 {
-  offer_tables offers_t(get_self(), get_self().value);
+  buy_offer_tables buyoffers_t(get_self(), get_buy_offer_partition(buy_offer_id).value);
 
-  auto boitr = offers_t.find(buy_offer_id);
-  check(boitr != offers_t.end(), "buy offer not found");
-  check(boitr->type == offer_type_buy, "offer is not a buy offer");
+  auto boitr = buyoffers_t.find(buy_offer_id);
 
   require_auth(boitr->buyer);
 
   check(boitr->current_status == buy_offer_status_accepted, "can not pay the offer, the offer is not accepted");
 
-  offers_t.modify(boitr, _self, [&](auto & buyoffer){
-    buyoffer.status_history.insert(std::make_pair(buy_offer_status_paid, current_time_point()));
-    buyoffer.current_status = buy_offer_status_paid;
-  });
+  update_offer_status(buyoffers_t, boitr, buy_offer_status_paid);
 }
 
 ACTION escrow::confrmpaymnt(const uint64_t & buy_offer_id, const std::string & memo)
 {
-  offer_tables offers_t(get_self(), get_self().value);
+  buy_offer_tables buyoffers_t(get_self(), get_buy_offer_partition(buy_offer_id).value);
 
-  auto boitr = offers_t.find(buy_offer_id);
-  check(boitr != offers_t.end(), "buy offer not found");
+  auto boitr = buyoffers_t.find(buy_offer_id);
 
   name seller = boitr->seller;
   name buyer = boitr->buyer;
@@ -509,72 +820,399 @@ ACTION escrow::confrmpaymnt(const uint64_t & buy_offer_id, const std::string & m
 
   check(boitr->current_status == buy_offer_status_paid, "can not confirm payment, offer is not marked as paid");
 
-  asset quantity = boitr->quantity_info.find(name("buyquantity"))->second;
+  asset quantity = boitr->quantity;
+  uint64_t sell_id = boitr->sell_id;
 
   send_transfer(boitr->buyer, quantity, std::string("SEEDS bought from " + seller.to_string()));
 
-  offers_t.modify(boitr, _self, [&](auto & buyoffer) {
-    buyoffer.status_history.insert(std::make_pair(buy_offer_status_successful, current_time_point()));
-    buyoffer.current_status = buy_offer_status_successful;
-  });
+  update_offer_status(buyoffers_t, boitr, buy_offer_status_successful);
 
-  balances_tables balances_t(get_self(), get_self().value);
+  ledger_tables ledger_t(get_self(), get_self().value);
 
-  auto bitr = balances_t.find(seller.value);
+  auto litr = ledger_t.find(seller.value);
 
-  balances_t.modify(bitr, _self, [&](auto & balance){
-    balance.escrow_balance -= quantity;
+  ledger_t.modify(litr, _self, [&](auto & ledger){
+    ledger.escrow -= quantity.amount;
+    ledger.add_successful_trades(true, 1);
   });
 
-  check_sale_success(buy_offer_id);
+  send_balance_event(seller, 0, 0, -quantity.amount);
+
+  rank_account(leaderboard_total, seller, litr->total_trx);
+  rank_account(leaderboard_sell, seller, litr->sell_successful);
+
+  close_buy_offers(sell_id, 1, quantity);
 
-  add_success_transaction(seller, offer_type_sell);
   add_success_transaction(buyer, offer_type_buy);
 }
 
-// ACTION escrow::initarbitrge() {}
+ACTION escrow::accptbuyoff2(const unsigned_int & buy_offer_id)
+{
+  accptbuyoffr(buy_offer_id.value, std::string());
+}
 
-void escrow::send_transfer(const name & beneficiary, const asset & quantity, const std::string & memo)
+ACTION escrow::payoffer2(const unsigned_int & buy_offer_id)
 {
-  action(
-    permission_level(get_self(), "active"_n),
-    seeds::token,
-    "transfer"_n,
-    std::make_tuple(get_self(), beneficiary, quantity, memo)
-  ).send();
+  payoffer(buy_offer_id.value, std::string());
 }
 
-void escrow::add_success_transaction(const name & account, const name & trx_type)
+ACTION escrow::confrmpaymn2(const unsigned_int & buy_offer_id)
 {
-  transactions_stats_tables trx_stats_t(get_self(), get_self().value);
+  confrmpaymnt(buy_offer_id.value, std::string());
+}
+
+// Applies accept, reject and confirm operations of one seller in order. The seller
+// balance is updated once and each buyer gets a single transfer at the end.
+ACTION escrow::batchseller(const name & seller, const std::vector<seller_operation> & operations, const std::string & memo)
+{
+  require_auth(seller);
+  check(!operations.empty(), "operations can not be empty");
+
+  buy_offer_tables open_buyoffers_t(get_self(), offer_partition_open.value);
+  buy_offer_tables inflight_buyoffers_t(get_self(), offer_partition_inflight.value);
+
+  asset escrowed = asset(0, util::seeds_symbol);
+  asset released = asset(0, util::seeds_symbol);
+  uint32_t confirmed = 0;
+
+  std::map<name, asset> transfers;
+  std::map<name, uint32_t> buyer_successes;
+  std::map<uint64_t, std::pair<uint64_t, asset>> closed;
+
+  for (const seller_operation & op : operations)
+  {
+    string offer_id = std::to_string(op.buy_offer_id);
+
+    if (op.operation == seller_operation_accept || op.operation == seller_operation_reject)
+    {
+      auto boitr = open_buyoffers_t.find(op.buy_offer_id);
+      check(boitr != open_buyoffers_t.end(), "buy offer " + offer_id + " is not pending");
+      check(boitr->seller == seller, "buy offer " + offer_id + " does not belong to the seller");
 
-  auto titr = trx_stats_t.find(account.value);
+      asset quantity = boitr->quantity;
+      uint64_t sell_id = boitr->sell_id;
 
-  trx_stats_t.modify(titr, _self, [&](auto & trxstats){
-    trxstats.total_trx += 1;
-    if(trx_type == offer_type_sell)
+      if (op.operation == seller_operation_accept)
+      {
+        update_offer_status(open_buyoffers_t, boitr, buy_offer_status_accepted);
+        take_from_sell_offer(sell_id, quantity);
+        escrowed += quantity;
+      }
+      else
+      {
+        update_offer_status(open_buyoffers_t, boitr, buy_offer_status_rejected);
+        auto & sell_closed = closed.try_emplace(sell_id, 0, asset(0, util::seeds_symbol)).first->second;
+        sell_closed.first += 1;
+      }
+    }
+    else if (op.operation == seller_operation_confirm)
     {
-      trxstats.sell_successful += 1;
+      auto boitr = inflight_buyoffers_t.find(op.buy_offer_id);
+      check(boitr != inflight_buyoffers_t.end() && boitr->current_status == buy_offer_status_paid,
+        "buy offer " + offer_id + " is not marked as paid");
+      check(boitr->seller == seller, "buy offer " + offer_id + " does not belong to the seller");
+
+      asset quantity = boitr->quantity;
+      name buyer = boitr->buyer;
+
+      auto & sell_closed = closed.try_emplace(boitr->sell_id, 0, asset(0, util::seeds_symbol)).first->second;
+      sell_closed.first += 1;
+      sell_closed.second += quantity;
+
+      update_offer_status(inflight_buyoffers_t, boitr, buy_offer_status_successful);
+
+      transfers.try_emplace(buyer, asset(0, util::seeds_symbol)).first->second += quantity;
+      buyer_successes[buyer] += 1;
+      released += quantity;
+      confirmed++;
     }
     else
     {
-      trxstats.buy_successful += 1;
+      check(false, "unknown operation " + op.operation.to_string());
     }
-  });
-}
+  }
 
-void escrow::addarbiter(const name & account)
-{
-  require_auth(get_self());
+  ledger_tables ledger_t(get_self(), get_self().value);
 
-  user_tables users_t(get_self(), get_self().value);
-  auto uitr = users_t.find(account.value);
-  check(uitr != users_t.end(), "user not found");
-  check(uitr->is_arbiter == 0, "user is already arbiter");
+  auto litr = ledger_t.find(seller.value);
+  check(litr != ledger_t.end(), "seller balance not found");
 
-  users_t.modify(uitr, _self, [&](auto & user){
-    user.is_arbiter = true;
-  });
+  // a batch of rejections does not move any balance
+  if (escrowed.amount > 0 || released.amount > 0)
+  {
+    ledger_t.modify(litr, _self, [&](auto & ledger){
+      ledger.swap -= escrowed.amount;
+      ledger.escrow += escrowed.amount - released.amount;
+      ledger.add_successful_trades(true, confirmed);
+    });
+
+    send_balance_event(seller, 0, -escrowed.amount, escrowed.amount - released.amount);
+  }
+
+  if (confirmed > 0)
+  {
+    rank_account(leaderboard_total, seller, litr->total_trx);
+    rank_account(leaderboard_sell, seller, litr->sell_successful);
+  }
+
+  for (const auto & [sell_id, sell_closed] : closed)
+  {
+    close_buy_offers(sell_id, sell_closed.first, sell_closed.second);
+  }
+
+  for (const auto & [buyer, quantity] : transfers)
+  {
+    send_transfer(buyer, quantity, std::string("SEEDS bought from " + seller.to_string()));
+    add_success_transaction(buyer, offer_type_buy, buyer_successes[buyer]);
+  }
+}
+
+// ACTION escrow::initarbitrge() {}
+
+void escrow::send_transfer(const name & beneficiary, const asset & quantity, const std::string & memo)
+{
+  action(
+    permission_level(get_self(), "active"_n),
+    seeds::token,
+    "transfer"_n,
+    std::make_tuple(get_self(), beneficiary, quantity, memo)
+  ).send();
+}
+
+// A cached status is trusted while it is fresh and good enough. Otherwise it is read
+// again from accts.seeds, so a user that was just promoted does not wait for the ttl.
+void escrow::check_seeds_user_status(const name & account, const name & min_status)
+{
+  seeds_status_tables seeds_status_t(get_self(), get_self().value);
+
+  auto ssitr = seeds_status_t.find(account.value);
+  uint32_t now = current_time_point().sec_since_epoch();
+
+  if (ssitr != seeds_status_t.end() &&
+    now - ssitr->updated_date.sec_since_epoch() < get_settings().status_ttl &&
+    util::has_seeds_user_status(ssitr->status, min_status))
+  {
+    return;
+  }
+
+  name status = util::get_seeds_user_status(account);
+  util::check_seeds_user_status(account, status, min_status);
+
+  if (ssitr != seeds_status_t.end())
+  {
+    seeds_status_t.modify(ssitr, _self, [&](auto & item){
+      item.status = status;
+      item.updated_date = time_point_sec(now);
+    });
+  }
+  else
+  {
+    seeds_status_t.emplace(_self, [&](auto & item){
+      item.account = account;
+      item.status = status;
+      item.updated_date = time_point_sec(now);
+    });
+  }
+}
+
+const escrow::settings_table & escrow::get_settings()
+{
+  if (!settings_cache)
+  {
+    settings_tables settings_t(get_self(), get_self().value);
+    settings_cache = settings_t.get_or_default(settings_table{});
+
+    // a parameter not set since the upgrade keeps its config value, or else its default
+    for (size_t i = 0; i < settings_count && settings_cache->initialized != settings_initialized; i++)
+    {
+      if ((settings_cache->initialized >> i) & 1) continue;
+
+      const settings_field & field = settings_fields[i];
+      auto citr = config.find(field.key.value);
+      set_setting(*settings_cache, field.key, citr != config.end() ? citr->value : SettingsValues(field.default_value));
+    }
+  }
+
+  return *settings_cache;
+}
+
+// Copies a known parameter into its settings field, returns false for any other key.
+bool escrow::set_setting(settings_table & settings, const name & key, const SettingsValues & value)
+{
+  size_t i = 0;
+  while (i < settings_count && settings_fields[i].key != key) i++;
+
+  if (i == settings_count) return false;
+
+  check(std::holds_alternative<uint64_t>(value), "settings: the " + key.to_string() + " parameter must be a uint64");
+  check(key != name("s.cancl.btch") || std::get<uint64_t>(value) > 0, "settings: the s.cancl.btch parameter must be greater than 0");
+
+  settings.*settings_fields[i].member = std::get<uint64_t>(value);
+  settings.initialized |= uint64_t(1) << i;
+
+  return true;
+}
+
+// Offers created within the same p.snap.age window share one price epoch.
+asset escrow::get_seeds_per_usd()
+{
+  price_snapshot_tables price_snapshot_t(get_self(), get_self().value);
+  uint32_t now = current_time_point().sec_since_epoch();
+
+  if (price_snapshot_t.exists())
+  {
+    price_snapshot_table snapshot = price_snapshot_t.get();
+    if (now - snapshot.fetched_date.sec_since_epoch() < get_settings().price_snapshot_age)
+    {
+      return snapshot.seeds_per_usd;
+    }
+  }
+
+  price_tables price(seeds::tlosto, seeds::tlosto.value);
+  price_table p = price.get();
+
+  price_snapshot_t.set(price_snapshot_table{ p.current_seeds_per_usd, p.current_round_id, time_point_sec(now) }, _self);
+
+  return p.current_seeds_per_usd;
+}
+
+void escrow::add_success_transaction(const name & account, const name & trx_type, const uint32_t & count)
+{
+  ledger_tables ledger_t(get_self(), get_self().value);
+
+  auto litr = ledger_t.find(account.value);
+
+  ledger_t.modify(litr, _self, [&](auto & ledger){
+    ledger.add_successful_trades(trx_type == offer_type_sell, count);
+  });
+
+  rank_account(leaderboard_total, account, litr->total_trx);
+  if (trx_type == offer_type_sell) rank_account(leaderboard_sell, account, litr->sell_successful);
+  else rank_account(leaderboard_buy, account, litr->buy_successful);
+}
+
+// Keeps account on the leaderboard of category when its count is above the lowest one
+// there, the board only has to be touched by trades that change the ranking.
+void escrow::rank_account(const name & category, const name & account, const uint64_t & successful)
+{
+  leaderboard_state_tables leaderboard_state_t(get_self(), get_self().value);
+  auto sitr = leaderboard_state_t.find(category.value);
+
+  uint64_t size = sitr != leaderboard_state_t.end() ? sitr->size : 0;
+  uint64_t threshold = sitr != leaderboard_state_t.end() ? sitr->threshold : 0;
+  uint64_t max_size = get_settings().leaderboard_size;
+
+  if (successful == 0 || (size >= max_size && successful <= threshold)) return;
+
+  leaderboard_tables leaderboard_t(get_self(), category.value);
+  auto litr = leaderboard_t.find(account.value);
+
+  if (litr != leaderboard_t.end())
+  {
+    leaderboard_t.modify(litr, _self, [&](auto & item){
+      item.successful = successful;
+    });
+  }
+  else
+  {
+    leaderboard_t.emplace(_self, [&](auto & item){
+      item.account = account;
+      item.successful = successful;
+    });
+    size++;
+  }
+
+  auto leaderboard_by_successful = leaderboard_t.get_index<name("bysuccess")>();
+  while (size > max_size)
+  {
+    leaderboard_by_successful.erase(leaderboard_by_successful.begin());
+    size--;
+  }
+
+  threshold = size > 0 ? leaderboard_by_successful.begin()->successful : 0;
+
+  if (sitr != leaderboard_state_t.end())
+  {
+    leaderboard_state_t.modify(sitr, _self, [&](auto & item){
+      item.size = size;
+      item.threshold = threshold;
+    });
+  }
+  else
+  {
+    leaderboard_state_t.emplace(_self, [&](auto & item){
+      item.category = category;
+      item.size = size;
+      item.threshold = threshold;
+    });
+  }
+}
+
+// Reserves quantity of an accepted buy offer, the sell offer is soldout once nothing is left.
+void escrow::take_from_sell_offer(const uint64_t & sell_offer_id, const asset & quantity)
+{
+  sell_offer_tables selloffers_t(get_self(), get_sell_offer_partition(sell_offer_id).value);
+  auto sitr = selloffers_t.find(sell_offer_id);
+
+  check(sitr->available >= quantity, "sell offer does not have enough funds");
+
+  if (sitr->available == quantity) {
+    update_offer_status(selloffers_t, sitr, sell_offer_status_soldout, [&](auto & selloffer){
+      selloffer.available -= quantity;
+    });
+  } else {
+    selloffers_t.modify(sitr, _self, [&](auto & selloffer){
+      selloffer.available -= quantity;
+    });
+    send_offer_event(*sitr, sitr->current_status);
+  }
+}
+
+// Gives back the quantity reserved by an accepted buy offer that was rolled back. A soldout
+// sell offer becomes active again, for a canceled one the funds go back to the seller.
+void escrow::return_to_sell_offer(const uint64_t & sell_offer_id, const asset & quantity)
+{
+  sell_offer_tables selloffers_t(get_self(), get_sell_offer_partition(sell_offer_id).value);
+  auto sitr = selloffers_t.find(sell_offer_id);
+
+  name seller = sitr->seller;
+  bool canceled = sitr->current_status == sell_offer_status_canceled;
+
+  if (sitr->current_status == sell_offer_status_soldout) {
+    update_offer_status(selloffers_t, sitr, sell_offer_status_active, [&](auto & selloffer){
+      selloffer.available += quantity;
+    });
+  } else if (!canceled) {
+    selloffers_t.modify(sitr, _self, [&](auto & selloffer){
+      selloffer.available += quantity;
+    });
+    send_offer_event(*sitr, sitr->current_status);
+  }
+
+  ledger_tables ledger_t(get_self(), get_self().value);
+  auto litr = ledger_t.find(seller.value);
+
+  ledger_t.modify(litr, _self, [&](auto & ledger){
+    ledger.escrow -= quantity.amount;
+    if (canceled) ledger.available += quantity.amount;
+    else ledger.swap += quantity.amount;
+  });
+
+  send_balance_event(seller, canceled ? quantity.amount : 0, canceled ? 0 : quantity.amount, -quantity.amount);
+}
+
+void escrow::addarbiter(const name & account)
+{
+  require_auth(get_self());
+
+  user_tables users_t(get_self(), get_self().value);
+  auto uitr = users_t.find(account.value);
+  check(uitr != users_t.end(), "user not found");
+  check(uitr->is_arbiter == 0, "user is already arbiter");
+
+  users_t.modify(uitr, _self, [&](auto & user){
+    user.is_arbiter = true;
+  });
 
 }
 
@@ -594,10 +1232,9 @@ void escrow::delarbiter(const name & account)
 
 void escrow::initarbitrage(const uint64_t & buy_offer_id, const std::string & memo)
 {
-  offer_tables offers_t(get_self(), get_self().value);
+  buy_offer_tables buyoffers_t(get_self(), get_buy_offer_partition(buy_offer_id).value);
 
-  auto boitr = offers_t.find(buy_offer_id);
-  check(boitr != offers_t.end(), "buy offer not found");
+  auto boitr = buyoffers_t.find(buy_offer_id);
 
   name seller = boitr->seller;
   name buyer = boitr->buyer;
@@ -605,8 +1242,12 @@ void escrow::initarbitrage(const uint64_t & buy_offer_id, const std::string & me
   name auth = has_auth(seller) ? seller : buyer;
   require_auth(auth);
 
-  auto paid_date = boitr->status_history.find(name("b.paid"))->second;
-  uint64_t max_seller_time = config_get_uint64(name("b.confrm.lim"));
+  uint8_t paid_index = get_status_index(*boitr, buy_offer_status_paid);
+  check(boitr->current_status == buy_offer_status_paid && boitr->status_history.has(paid_index),
+    "can not create arbitrage, offer is not marked as paid");
+
+  time_point paid_date = boitr->status_history.get(paid_index);
+  uint64_t max_seller_time = get_settings().confirm_limit;
   uint64_t cutoff = current_time_point().sec_since_epoch() - max_seller_time;
   check(paid_date.sec_since_epoch() < cutoff, "can not create arbitrage, it is too early");
 
@@ -625,10 +1266,7 @@ void escrow::initarbitrage(const uint64_t & buy_offer_id, const std::string & me
     arbitrage.seller_contact.insert(std::make_pair(seller, false));
   });
 
-  offers_t.modify(boitr, _self, [&](auto & buyoffer){
-    buyoffer.status_history.insert(std::make_pair(arbitrage_status_pending, current_time_point()));
-    buyoffer.current_status = arbitrage_status_pending;
-  });
+  update_offer_status(buyoffers_t, boitr, arbitrage_status_pending);
 }
 
 void escrow::arbtrgeoffer(const name & arbiter, const uint64_t & offer_id, const std::string & memo)
@@ -645,21 +1283,22 @@ void escrow::arbtrgeoffer(const name & arbiter, const uint64_t & offer_id, const
 
   auto aritr = arbitrage_offers_t.find(offer_id);
   check(aritr != arbitrage_offers_t.end(), "arbitrage does not exist");
+  check(aritr->resolution == arbitrage_pending, "this arbitration ticket isn't pending");
 
-  offer_tables offers_t(get_self(), get_self().value);
+  name partition = find_offer_partition<buy_offer_tables>(offer_id);
+  check(partition != name(), "offer does not exist");
+
+  buy_offer_tables buyoffers_t(get_self(), partition.value);
   
-  auto boitr = offers_t.find(offer_id);
-  check(boitr != offers_t.end(), "offer does not exist");
+  auto boitr = buyoffers_t.find(offer_id);
+  check(boitr != buyoffers_t.end() && boitr->current_status == arbitrage_status_pending, "offer is not waiting for an arbiter");
 
   arbitrage_offers_t.modify(aritr, _self, [&](auto & arbitrage){
     arbitrage.resolution = arbitrage_status_inprogress;
     arbitrage.arbiter = arbiter;
   });
 
-  offers_t.modify(boitr, _self, [&](auto & buyoffer){
-    buyoffer.status_history.insert(std::make_pair(arbitrage_status_inprogress, current_time_point()));
-    buyoffer.current_status = arbitrage_status_inprogress;
-  });
+  update_offer_status(buyoffers_t, boitr, arbitrage_status_inprogress);
 }
 
 void escrow::resolvesellr(const uint64_t & offer_id, const string & notes, const std::string & memo)
@@ -673,50 +1312,25 @@ void escrow::resolvesellr(const uint64_t & offer_id, const string & notes, const
   name arbiter = aritr->arbiter;
   require_auth(arbiter);
 
-  offer_tables offers_t(get_self(), get_self().value);
+  buy_offer_tables buyoffers_t(get_self(), get_buy_offer_partition(offer_id).value);
 
-  auto boitr = offers_t.find(offer_id);
-  check(boitr != offers_t.end(), "buy offer not found");
-  check(boitr->type == offer_type_buy, "offer is not a buy offer");
+  auto boitr = buyoffers_t.find(offer_id);
   check(boitr->current_status == arbitrage_status_inprogress, "offer is not under arbitration");
 
-  asset quantity = boitr->quantity_info.find(name("buyquantity"))->second;
+  asset quantity = boitr->quantity;
   name seller = boitr->seller;
-
-  balances_tables balances_t(get_self(), get_self().value);
-
-  auto bitr = balances_t.find(seller.value);
-  check(bitr != balances_t.end(), "balance not found");
-
-  buy_sell_relation_tables buysellrel_t(get_self(), get_self().value);
-
-  auto buysellrel_by_buy = buysellrel_t.get_index<name("bybuy")>();
-  auto bsritr = buysellrel_by_buy.get(offer_id, "buy offer id relation not found");
-
-  auto sitr = offers_t.find(bsritr.sell_offer_id);
-  check(sitr != offers_t.end(), "sell offer not found");
-
-  asset available = sitr->quantity_info.find(name("available"))->second;
-  asset totaloffered = sitr->quantity_info.find(name("totaloffered"))->second;
-
-  offers_t.modify(sitr, _self, [&](auto & selloffer) {
-    selloffer.quantity_info.at(name("available")) = available + quantity; // Return offered to available
-  });
+  uint64_t sell_id = boitr->sell_id;
 
   arbitrage_offers_t.modify(aritr, _self, [&](auto & arbitrage) {
     arbitrage.resolution = seller;
     arbitrage.notes = notes;
   });
 
-  balances_t.modify(bitr, _self, [&](auto & balance) {
-    balance.escrow_balance -= quantity;
-    balance.swap_balance += quantity;
-  });
+  return_to_sell_offer(sell_id, quantity);
 
-  offers_t.modify(boitr, _self, [&](auto & buyoffer){
-    buyoffer.status_history.insert(std::make_pair(buy_offer_status_flagged, current_time_point()));
-    buyoffer.current_status = buy_offer_status_flagged;
-  });
+  update_offer_status(buyoffers_t, boitr, buy_offer_status_flagged);
+
+  close_buy_offers(sell_id, 1, asset(0, util::seeds_symbol));
 
   // Penalize buyer - pending
 }
@@ -732,21 +1346,20 @@ void escrow::resolvebuyer(const uint64_t & offer_id, const string & notes, const
   name arbiter = aritr->arbiter;
   require_auth(arbiter);
 
-  offer_tables offers_t(get_self(), get_self().value);
+  buy_offer_tables buyoffers_t(get_self(), get_buy_offer_partition(offer_id).value);
 
-  auto boitr = offers_t.find(offer_id);
-  check(boitr != offers_t.end(), "buy offer not found");
-  check(boitr->type == offer_type_buy, "offer is not a buy offer");
+  auto boitr = buyoffers_t.find(offer_id);
   check(boitr->current_status == arbitrage_status_inprogress, "offer is not under arbitration");
 
   name buyer = boitr->buyer;
   name seller = boitr->seller;
-  asset quantity = boitr->quantity_info.find(name("buyquantity"))->second;
+  asset quantity = boitr->quantity;
+  uint64_t sell_id = boitr->sell_id;
 
-  balances_tables balances_t(get_self(), get_self().value);
+  ledger_tables ledger_t(get_self(), get_self().value);
 
-  auto sitr = balances_t.find(seller.value);
-  check(sitr != balances_t.end(), "balance not found");
+  auto litr = ledger_t.find(seller.value);
+  check(litr != ledger_t.end(), "balance not found");
 
   send_transfer(boitr->buyer, quantity, std::string("SEEDS bought from " + seller.to_string()));
 
@@ -755,20 +1368,19 @@ void escrow::resolvebuyer(const uint64_t & offer_id, const string & notes, const
     arbitrage.notes = notes;
   });
 
-  balances_t.modify(sitr, _self, [&](auto & balance) {
-    balance.escrow_balance -= quantity;
+  ledger_t.modify(litr, _self, [&](auto & ledger) {
+    ledger.escrow -= quantity.amount;
   });
 
+  send_balance_event(litr->account, 0, 0, -quantity.amount);
+
   // TODO - Reduce available quantity of sell offer
 
-  offers_t.modify(boitr, _self, [&](auto & buyoffer) {
-    buyoffer.status_history.insert(std::make_pair(buy_offer_status_successful, current_time_point()));
-    buyoffer.current_status = buy_offer_status_successful;
-  });
+  update_offer_status(buyoffers_t, boitr, buy_offer_status_successful);
 
   add_success_transaction(buyer, offer_type_buy);
 
-  check_sale_success(offer_id);
+  close_buy_offers(sell_id, 1, quantity);
 
   // Penalize seller - pending
 }
@@ -782,10 +1394,9 @@ ACTION escrow::addoffermsg(
   const std::string & memo
 )
 {
-  offer_tables offers_t(get_self(), get_self().value);
+  buy_offer_tables buyoffers_t(get_self(), get_buy_offer_partition(buy_offer_id).value);
 
-  auto boitr = offers_t.require_find(buy_offer_id, "buy offer not found");
-  check(boitr->type == offer_type_buy, "offer is not a buy offer");
+  auto boitr = buyoffers_t.find(buy_offer_id);
 
   name seller = boitr->seller;
   name buyer = boitr->buyer;
@@ -794,31 +1405,39 @@ ACTION escrow::addoffermsg(
   name receiver = sender == boitr->seller ? boitr->buyer : boitr->seller;
 
   require_auth(sender);
-  
-  private_message_tables msg_t(get_self(), get_self().value);
 
-  msg_t.emplace(_self, [&](auto & item) {
-    item.id = msg_t.available_primary_key();
-    item.buy_offer_id = buy_offer_id;
-    item.sender = sender;
-    item.receiver = receiver;
-    item.iv = iv;
-    item.ephem_key = ephem_key;
-    item.message = message;
-    item.mac = mac;
-  });
+  add_message(buy_offer_id, sender, receiver, iv, ephem_key, message, mac);
 }
 
 
+ACTION escrow::addoffermsg2(
+  const unsigned_int & buy_offer_id,
+  const string & iv,
+  const string & ephem_key,
+  const string & message,
+  const checksum256 & mac
+)
+{
+  addoffermsg(buy_offer_id.value, iv, ephem_key, message, mac, std::string());
+}
+
 ACTION escrow::delprivtemsg(const uint64_t & message_id, const std::string & memo)
 {
   private_message_tables msg_t(get_self(), get_self().value);
-  auto mitr = msg_t.require_find(message_id, "message not found");
+  auto mitr = msg_t.find(message_id);
 
-  name auth = has_auth(mitr->sender) ? mitr->sender : mitr->receiver;
-  require_auth(auth);
+  if (mitr != msg_t.end())
+  {
+    require_auth(has_auth(mitr->sender) ? mitr->sender : mitr->receiver);
+    msg_t.erase(mitr);
+    return;
+  }
+
+  message_anchor_tables anchors_t(get_self(), get_self().value);
+  auto aitr = anchors_t.require_find(message_id, "message not found");
 
-  msg_t.erase(mitr);
+  require_auth(has_auth(aitr->sender) ? aitr->sender : aitr->receiver);
+  anchors_t.erase(aitr);
 }
 
 ACTION escrow::sendconmethd (
@@ -829,10 +1448,9 @@ ACTION escrow::sendconmethd (
   const checksum256 & mac,
   const std::string & memo
 ) {
-  offer_tables offers_t(get_self(), get_self().value);
+  buy_offer_tables buyoffers_t(get_self(), get_buy_offer_partition(buy_offer_id).value);
 
-  auto boitr = offers_t.require_find(buy_offer_id, "buy offer not found");
-  check(boitr->type == offer_type_buy, "offer is not a buy offer");
+  auto boitr = buyoffers_t.find(buy_offer_id);
 
   name seller = boitr->seller;
   name buyer = boitr->buyer;
@@ -857,53 +1475,798 @@ ACTION escrow::sendconmethd (
     }
   });
 
+  add_message(buy_offer_id, auth, arbiter, iv, ephem_key, message, mac);
+}
+
+ACTION escrow::prune(const uint64_t & max_rows)
+{
+  check(max_rows > 0, "max_rows must be greater than 0");
+
+  uint64_t max_age = get_settings().prune_age;
+  uint64_t now = current_time_point().sec_since_epoch();
+  uint64_t cutoff = now > max_age ? now - max_age : 0;
+
+  prune_state_tables prune_state_t(get_self(), get_self().value);
+  prune_state_table state = prune_state_t.get_or_default(prune_state_table{ 0, 0 });
+
+  uint64_t scanned = 0;
+
+  buy_offer_tables buyoffers_t(get_self(), offer_partition_terminal.value);
+  buy_sell_relation_tables buysellrel_t(get_self(), get_self().value);
+  arbitrage_tables arbitrage_offers_t(get_self(), get_self().value);
+
+  auto buysellrel_by_buy = buysellrel_t.get_index<name("bybuy")>();
+
+  auto boitr = buyoffers_t.lower_bound(state.buy_offer_id);
+  while (boitr != buyoffers_t.end() && scanned < max_rows)
+  {
+    scanned++;
+
+    time_point closed_date = boitr->status_history.get(get_status_index(*boitr, boitr->current_status));
+    if (closed_date.sec_since_epoch() > cutoff)
+    {
+      boitr++;
+      continue;
+    }
+
+    send_offer_log(boitr->id, boitr->sell_id, boitr->seller, boitr->buyer, boitr->quantity,
+      boitr->price_percentage, boitr->fiat_currency, boitr->current_status, boitr->created_date, closed_date);
+
+    auto bsritr = buysellrel_by_buy.find(boitr->id);
+    if (bsritr != buysellrel_by_buy.end())
+    {
+      buysellrel_by_buy.erase(bsritr);
+    }
+
+    auto aritr = arbitrage_offers_t.find(boitr->id);
+    if (aritr != arbitrage_offers_t.end())
+    {
+      arbitrage_offers_t.erase(aritr);
+    }
+
+    boitr = buyoffers_t.erase(boitr);
+  }
+
+  state.buy_offer_id = boitr != buyoffers_t.end() ? boitr->id : 0;
+
+  sell_offer_tables selloffers_t(get_self(), offer_partition_terminal.value);
+
+  auto soitr = selloffers_t.lower_bound(state.sell_offer_id);
+  while (soitr != selloffers_t.end() && scanned < max_rows)
+  {
+    scanned++;
+
+    time_point closed_date = soitr->status_history.get(get_status_index(*soitr, soitr->current_status));
+
+    // a canceled sell offer can still have accepted buy offers settling against it
+    if (closed_date.sec_since_epoch() > cutoff || soitr->open_buy_offers > 0)
+    {
+      soitr++;
+      continue;
+    }
+
+    send_offer_log(soitr->id, soitr->id, soitr->seller, name(), soitr->total_offered,
+      soitr->price_percentage, soitr->fiat_currency, soitr->current_status, soitr->created_date, closed_date);
+
+    soitr = selloffers_t.erase(soitr);
+  }
+
+  state.sell_offer_id = soitr != selloffers_t.end() ? soitr->id : 0;
+
+  prune_state_t.set(state, _self);
+}
+
+escrow::offer_page escrow::getoffers(const offer_filter & filter, const uint64_t & cursor, const uint64_t & limit)
+{
+  check(limit > 0 && limit <= max_query_limit, "limit must be between 1 and " + std::to_string(max_query_limit));
+  check(filter.offer_type == offer_type_sell || filter.offer_type == offer_type_buy, "invalid offer type");
+  check(std::find(std::begin(offer_partitions), std::end(offer_partitions), filter.partition) != std::end(offer_partitions), "invalid partition");
+
+  offer_page page { {}, 0, false };
+
+  // rows of the chosen index are read from the cursor on, the ones outside the filter are skipped.
+  // A page ends after limit matches or max_query_scan rows, so it can be short and still have more.
+  auto read_page = [&](auto & index, auto begin, auto in_range, auto matches, auto summary) {
+    uint64_t scanned = 0;
+    auto itr = index.lower_bound(begin);
+    while (itr != index.end() && in_range(*itr))
+    {
+      if (page.offers.size() == limit || scanned == max_query_scan)
+      {
+        page.next_cursor = itr->id;
+        page.more = true;
+        return;
+      }
+      if (matches(*itr)) page.offers.push_back(summary(*itr));
+      scanned++;
+      itr++;
+    }
+  };
+
+  auto any = [](const auto & offer) { return true; };
+
+  if (filter.offer_type == offer_type_sell)
+  {
+    sell_offer_tables selloffers_t(get_self(), filter.partition.value);
+
+    auto summary = [&](const sell_offer_table & offer) {
+      return offer_summary{ offer.id, offer.id, offer.seller, name(), offer.available,
+        offer.price_percentage, offer.fiat_currency, offer.current_status };
+    };
+
+    if (filter.seller != name())
+    {
+      auto selloffers_by_seller = selloffers_t.get_index<name("bysellerid")>();
+      read_page(selloffers_by_seller, (uint128_t(filter.seller.value) << 64) + cursor,
+        [&](const sell_offer_table & offer) { return offer.seller == filter.seller; }, any, summary);
+    }
+    else
+    {
+      read_page(selloffers_t, cursor, any, any, summary);
+    }
+
+    return page;
+  }
+
+  buy_offer_tables buyoffers_t(get_self(), filter.partition.value);
+
+  auto summary = [&](const buy_offer_table & offer) {
+    return offer_summary{ offer.id, offer.sell_id, offer.seller, offer.buyer, offer.quantity,
+      offer.price_percentage, offer.fiat_currency, offer.current_status };
+  };
+
+  if (filter.buyer != name())
+  {
+    auto buyoffers_by_buyer = buyoffers_t.get_index<name("bybuyerid")>();
+    read_page(buyoffers_by_buyer, (uint128_t(filter.buyer.value) << 64) + cursor,
+      [&](const buy_offer_table & offer) { return offer.buyer == filter.buyer; },
+      [&](const buy_offer_table & offer) { return filter.seller == name() || offer.seller == filter.seller; },
+      summary);
+  }
+  else if (filter.seller != name())
+  {
+    auto buyoffers_by_seller = buyoffers_t.get_index<name("bysellerid")>();
+    read_page(buyoffers_by_seller, (uint128_t(filter.seller.value) << 64) + cursor,
+      [&](const buy_offer_table & offer) { return offer.seller == filter.seller; }, any, summary);
+  }
+  else
+  {
+    read_page(buyoffers_t, cursor, any, any, summary);
+  }
+
+  return page;
+}
+
+// Messages and hash only anchors of a buy offer merged in id order, limit counts both.
+escrow::message_page escrow::getmessages(const uint64_t & buy_offer_id, const uint64_t & cursor, const uint64_t & limit)
+{
+  check(limit > 0 && limit <= max_query_limit, "limit must be between 1 and " + std::to_string(max_query_limit));
+
+  private_message_tables messages_t(get_self(), get_self().value);
+  auto messages_by_buy_offer = messages_t.get_index<name("bybuyid")>();
+
+  message_anchor_tables anchors_t(get_self(), get_self().value);
+  auto anchors_by_buy_offer = anchors_t.get_index<name("bybuyid")>();
+
+  message_page page { {}, {}, 0, false };
+
+  auto mitr = messages_by_buy_offer.lower_bound((uint128_t(buy_offer_id) << 64) + cursor);
+  auto aitr = anchors_by_buy_offer.lower_bound((uint128_t(buy_offer_id) << 64) + cursor);
+
+  while (true)
+  {
+    bool has_message = mitr != messages_by_buy_offer.end() && mitr->buy_offer_id == buy_offer_id;
+    bool has_anchor = aitr != anchors_by_buy_offer.end() && aitr->buy_offer_id == buy_offer_id;
+
+    if (!has_message && !has_anchor) break;
+
+    bool take_message = has_message && (!has_anchor || mitr->id < aitr->id);
+
+    if (page.messages.size() + page.anchors.size() == limit)
+    {
+      page.next_cursor = take_message ? mitr->id : aitr->id;
+      page.more = true;
+      break;
+    }
+
+    if (take_message)
+    {
+      page.messages.push_back(message_entry{ mitr->id, mitr->sender, mitr->receiver,
+        mitr->iv, mitr->ephem_key, mitr->message, mitr->mac });
+      mitr++;
+    }
+    else
+    {
+      page.anchors.push_back(message_anchor_entry{ aitr->id, aitr->sender, aitr->receiver, aitr->payload_hash });
+      aitr++;
+    }
+  }
+
+  return page;
+}
+
+// arbitrations still waiting for an arbiter, oldest offer first
+escrow::arbitrage_page escrow::getarbqueue(const uint64_t & cursor, const uint64_t & limit)
+{
+  check(limit > 0 && limit <= max_query_limit, "limit must be between 1 and " + std::to_string(max_query_limit));
+
+  arbitrage_tables arbitrage_offers_t(get_self(), get_self().value);
+  auto arbitrages_by_resolution = arbitrage_offers_t.get_index<name("byresid")>();
+
+  arbitrage_page page { {}, 0, false };
+
+  auto aritr = arbitrages_by_resolution.lower_bound((uint128_t(arbitrage_pending.value) << 64) + cursor);
+  while (aritr != arbitrages_by_resolution.end() && aritr->resolution == arbitrage_pending)
+  {
+    if (page.arbitrages.size() == limit)
+    {
+      page.next_cursor = aritr->offer_id;
+      page.more = true;
+      break;
+    }
+    page.arbitrages.push_back(arbitrage_summary{ aritr->offer_id, aritr->created_date });
+    aritr++;
+  }
+
+  return page;
+}
+
+void escrow::add_message(
+  const uint64_t & buy_offer_id,
+  const name & sender,
+  const name & receiver,
+  const string & iv,
+  const string & ephem_key,
+  const string & message,
+  const checksum256 & mac
+)
+{
   private_message_tables msg_t(get_self(), get_self().value);
+  message_anchor_tables anchors_t(get_self(), get_self().value);
+
+  // one id space for both tables, so delprivtemsg and getmessages can tell them apart
+  uint64_t id = std::max(msg_t.available_primary_key(), anchors_t.available_primary_key());
+
+  if (get_settings().hash_only_messages == 0)
+  {
+    msg_t.emplace(_self, [&](auto & item) {
+      item.id = id;
+      item.buy_offer_id = buy_offer_id;
+      item.sender = sender;
+      item.receiver = receiver;
+      item.iv = iv;
+      item.ephem_key = ephem_key;
+      item.message = message;
+      item.mac = mac;
+    });
+    return;
+  }
 
-  msg_t.emplace(_self, [&](auto & item) {
-    item.id = msg_t.available_primary_key();
+  std::vector<char> payload = pack(std::make_tuple(iv, ephem_key, message, mac));
+
+  anchors_t.emplace(_self, [&](auto & item) {
+    item.id = id;
     item.buy_offer_id = buy_offer_id;
-    item.sender = auth;
-    item.receiver = arbiter;
-    item.iv = iv;
-    item.ephem_key = ephem_key;
-    item.message = message;
-    item.mac = mac;
+    item.sender = sender;
+    item.receiver = receiver;
+    item.payload_hash = sha256(payload.data(), payload.size());
   });
 
+  action(
+    permission_level(get_self(), "active"_n),
+    get_self(),
+    "msglog"_n,
+    std::make_tuple(id, buy_offer_id, sender, receiver, iv, ephem_key, message, mac)
+  ).send();
 }
 
-void escrow::check_sale_success(const uint64_t & buy_offer_id) {
-  offer_tables offers_t(get_self(), get_self().value);
-  auto boitr = offers_t.require_find(buy_offer_id, "buy offer not found");
+ACTION escrow::msglog(
+  const uint64_t & id,
+  const uint64_t & buy_offer_id,
+  const name & sender,
+  const name & receiver,
+  const string & iv,
+  const string & ephem_key,
+  const string & message,
+  const checksum256 & mac
+)
+{
+  require_auth(get_self());
+}
 
-  uint64_t sell_id = boitr->sell_id;
+// Messages are kept until their buy offer has been finished for m.retention seconds,
+// or for good while the buy offer is under arbitration.
+ACTION escrow::prunemsgs(const uint64_t & max_rows)
+{
+  check(max_rows > 0, "max_rows must be greater than 0");
+
+  message_prune_state_tables message_prune_state_t(get_self(), get_self().value);
+  message_prune_state_table state = message_prune_state_t.get_or_default(message_prune_state_table{ 0, 0 });
+
+  uint64_t budget = max_rows;
+
+  state.message_buy_offer_id = erase_expired_messages<private_message_tables>(state.message_buy_offer_id, budget);
+  state.anchor_buy_offer_id = erase_expired_messages<message_anchor_tables>(state.anchor_buy_offer_id, budget);
+
+  message_prune_state_t.set(state, _self);
+}
+
+// Offers ledger accounts to the leaderboards, used to fill them after a migration or
+// after l.size has been raised.
+ACTION escrow::rankusers(const uint64_t & max_rows)
+{
+  check(max_rows > 0, "max_rows must be greater than 0");
 
-  auto soitr = offers_t.find(sell_id);
-  check(soitr != offers_t.end(), "sell offer not found");
+  rank_cursor_tables rank_cursor_t(get_self(), get_self().value);
+  rank_cursor_table cursor = rank_cursor_t.get_or_default(rank_cursor_table{ name() });
 
-  asset offered_quantity = soitr->quantity_info.find(name("totaloffered"))->second;
+  ledger_tables ledger_t(get_self(), get_self().value);
 
-  auto offers_by_sell = offers_t.get_index<name("bysellid")>();
-  auto boitr_sell = offers_by_sell.lower_bound(uint128_t(sell_id) << 64);
+  uint64_t ranked = 0;
+  auto litr = ledger_t.lower_bound(cursor.account.value);
 
-  asset total_sold = asset(0, util::seeds_symbol);
-  while (boitr_sell != offers_by_sell.end()) {
-    
-    if (boitr_sell->type == offer_type_buy) {
-      if (boitr_sell->sell_id != sell_id) { break; }
+  while (litr != ledger_t.end() && ranked < max_rows)
+  {
+    rank_account(leaderboard_total, litr->account, litr->total_trx);
+    rank_account(leaderboard_sell, litr->account, litr->sell_successful);
+    rank_account(leaderboard_buy, litr->account, litr->buy_successful);
+    litr++;
+    ranked++;
+  }
+
+  cursor.account = litr != ledger_t.end() ? litr->account : name();
+  rank_cursor_t.set(cursor, _self);
+}
 
-      asset quantity = boitr_sell->quantity_info.find(name("buyquantity"))->second;
-      if (boitr_sell->current_status == buy_offer_status_successful) total_sold += quantity;
+// Expires pending buy offers older than b.accpt.lim and rolls back accepted ones that were
+// not paid within b.pay.lim, at most max_rows offers per call.
+ACTION escrow::sweep(const uint64_t & max_rows)
+{
+  check(max_rows > 0, "max_rows must be greater than 0");
+
+  settings_table settings = get_settings();
+  uint64_t now = current_time_point().sec_since_epoch();
+
+  uint64_t swept = sweep_buy_offers(
+    offer_partition_open,
+    buy_offer_status_pending,
+    now > settings.accept_limit ? now - settings.accept_limit : 0,
+    max_rows
+  );
+
+  sweep_buy_offers(
+    offer_partition_inflight,
+    buy_offer_status_accepted,
+    now > settings.pay_limit ? now - settings.pay_limit : 0,
+    max_rows - swept
+  );
+}
+
+// Rejects up to max_rows buy offers of partition that entered status at or before cutoff,
+// returns how many were rejected.
+uint64_t escrow::sweep_buy_offers(const name & partition, const name & status, const uint64_t & cutoff, const uint64_t & max_rows)
+{
+  buy_offer_tables buyoffers_t(get_self(), partition.value);
+
+  // rejecting moves the offers out of the partition, collect them first
+  auto offers_by_status_date = buyoffers_t.get_index<name("bystatusdate")>();
+  auto oitr = offers_by_status_date.lower_bound(uint128_t(status.value) << 64);
+  auto last = offers_by_status_date.upper_bound((uint128_t(status.value) << 64) + cutoff);
+
+  std::vector<uint64_t> expired_offers;
+  while (oitr != last && expired_offers.size() < max_rows) {
+    expired_offers.push_back(oitr->id);
+    oitr++;
+  }
+
+  for (const uint64_t & buy_offer_id : expired_offers) {
+    auto bitr = buyoffers_t.find(buy_offer_id);
+    uint64_t sell_id = bitr->sell_id;
+
+    if (status == buy_offer_status_accepted) {
+      return_to_sell_offer(sell_id, bitr->quantity);
     }
-    boitr_sell++;
+
+    update_offer_status(buyoffers_t, bitr, buy_offer_status_rejected);
+    close_buy_offers(sell_id, 1, asset(0, util::seeds_symbol));
   }
 
-  bool all_is_sold = total_sold.amount == offered_quantity.amount;
+  return expired_offers.size();
+}
 
-  if (soitr->current_status == sell_offer_status_soldout && all_is_sold) {
-    offers_t.modify(soitr, _self, [&](auto & selloffer){
-      selloffer.status_history.insert(std::make_pair(sell_offer_status_successful, current_time_point()));
-      selloffer.current_status = sell_offer_status_successful;
-    });
+bool escrow::are_messages_expired(const uint64_t & buy_offer_id)
+{
+  arbitrage_tables arbitrage_offers_t(get_self(), get_self().value);
+
+  auto aritr = arbitrage_offers_t.find(buy_offer_id);
+  if (aritr != arbitrage_offers_t.end() &&
+    (aritr->resolution == arbitrage_pending || aritr->resolution == arbitrage_status_inprogress))
+  {
+    return false;
+  }
+
+  // a buy offer that is gone was deleted by its buyer or already pruned, unless it is
+  // still waiting in the legacy table for migrateoffrs
+  name partition = find_offer_partition<buy_offer_tables>(buy_offer_id);
+  if (partition == name())
+  {
+    offer_tables offers_t(get_self(), get_self().value);
+    return offers_t.find(buy_offer_id) == offers_t.end();
+  }
+  if (partition != offer_partition_terminal) return false;
+
+  buy_offer_tables buyoffers_t(get_self(), partition.value);
+  auto boitr = buyoffers_t.find(buy_offer_id);
+
+  time_point closed_date = boitr->status_history.get(get_status_index(*boitr, boitr->current_status));
+  uint64_t now = current_time_point().sec_since_epoch();
+
+  return now - closed_date.sec_since_epoch() >= get_settings().message_retention;
+}
+
+escrow::balance_view escrow::getbalance(const name & account)
+{
+  ledger_tables ledger_t(get_self(), get_self().value);
+  auto litr = ledger_t.require_find(account.value, "balance not found");
+
+  return balance_view{ litr->account, litr->available_balance(), litr->swap_balance(), litr->escrow_balance() };
+}
+
+escrow::trx_stats_view escrow::gettrxstats(const name & account)
+{
+  ledger_tables ledger_t(get_self(), get_self().value);
+  auto litr = ledger_t.require_find(account.value, "user not found");
+
+  return trx_stats_view{ litr->account, litr->total_trx, litr->sell_successful, litr->buy_successful };
+}
+
+ACTION escrow::offerlog(
+  const uint64_t & id,
+  const uint64_t & sell_id,
+  const name & seller,
+  const name & buyer,
+  const asset & quantity,
+  const uint64_t & price_percentage,
+  const name & fiat_currency,
+  const name & status,
+  const time_point & created_date,
+  const time_point & closed_date
+)
+{
+  require_auth(get_self());
+}
+
+ACTION escrow::offerevent(
+  const uint64_t & id,
+  const uint64_t & sell_id,
+  const name & old_status,
+  const name & new_status,
+  const asset & quantity,
+  const time_point & date
+)
+{
+  require_auth(get_self());
+}
+
+ACTION escrow::balevent(const name & account, const int64_t & available_delta, const int64_t & swap_delta, const int64_t & escrow_delta)
+{
+  require_auth(get_self());
+}
+
+// An empty old_status is a new offer, an empty new_status a deleted one. Equal statuses
+// mean only the quantity changed, like a sell offer partly taken by an accepted buy offer.
+void escrow::send_offer_event(const uint64_t & id, const uint64_t & sell_id, const name & old_status, const name & new_status, const asset & quantity)
+{
+  action(
+    permission_level(get_self(), "active"_n),
+    get_self(),
+    "offerevent"_n,
+    std::make_tuple(id, sell_id, old_status, new_status, quantity, current_time_point())
+  ).send();
+}
+
+void escrow::send_balance_event(const name & account, const int64_t & available_delta, const int64_t & swap_delta, const int64_t & escrow_delta)
+{
+  action(
+    permission_level(get_self(), "active"_n),
+    get_self(),
+    "balevent"_n,
+    std::make_tuple(account, available_delta, swap_delta, escrow_delta)
+  ).send();
+}
+
+void escrow::send_offer_log(
+  const uint64_t & id,
+  const uint64_t & sell_id,
+  const name & seller,
+  const name & buyer,
+  const asset & quantity,
+  const uint64_t & price_percentage,
+  const name & fiat_currency,
+  const name & status,
+  const time_point & created_date,
+  const time_point & closed_date
+)
+{
+  action(
+    permission_level(get_self(), "active"_n),
+    get_self(),
+    "offerlog"_n,
+    std::make_tuple(id, sell_id, seller, buyer, quantity, price_percentage, fiat_currency, status, created_date, closed_date)
+  ).send();
+}
+
+// Rejects up to max_rows pending buy offers of a sell offer, returns how many were rejected.
+uint64_t escrow::reject_pending_buy_offers(const uint64_t & sell_offer_id, const uint64_t & max_rows)
+{
+  // the open partition only holds pending buy offers, collect them first as rejecting moves them out
+  buy_offer_tables buyoffers_t(get_self(), offer_partition_open.value);
+
+  auto offersby_sell_id = buyoffers_t.get_index<name("bysellid")>();
+  auto obsitr = offersby_sell_id.lower_bound(uint128_t(sell_offer_id) << 64);
+
+  std::vector<uint64_t> pending_offers;
+  while (obsitr != offersby_sell_id.end() && obsitr->sell_id == sell_offer_id && pending_offers.size() < max_rows) {
+    pending_offers.push_back(obsitr->id);
+    obsitr++;
+  }
+
+  for (const uint64_t & buy_offer_id : pending_offers) {
+    update_offer_status(buyoffers_t, buyoffers_t.find(buy_offer_id), buy_offer_status_rejected);
+  }
+
+  if (!pending_offers.empty()) {
+    close_buy_offers(sell_offer_id, pending_offers.size(), asset(0, util::seeds_symbol));
+  }
+
+  return pending_offers.size();
+}
+
+// Bookkeeping for buy offers of a sell offer that were deleted or reached a terminal
+// status, sold is what they bought in total. Marks the sale successful once it is soldout
+// and everything offered has been sold.
+void escrow::close_buy_offers(const uint64_t & sell_offer_id, const uint64_t & count, const asset & sold) {
+  sell_offer_tables selloffers_t(get_self(), get_sell_offer_partition(sell_offer_id).value);
+  auto soitr = selloffers_t.find(sell_offer_id);
+
+  selloffers_t.modify(soitr, _self, [&](auto & selloffer){
+    selloffer.open_buy_offers -= count;
+    selloffer.sold += sold;
+  });
+
+  if (soitr->current_status == sell_offer_status_soldout && soitr->sold == soitr->total_offered) {
+    update_offer_status(selloffers_t, soitr, sell_offer_status_successful);
+  }
+}
+
+uint64_t escrow::get_next_offer_id()
+{
+  offer_ids_tables offer_ids_t(get_self(), get_self().value);
+
+  // before the first migrated or new offer the sequence continues after the legacy ids
+  if (!offer_ids_t.exists())
+  {
+    offer_tables offers_t(get_self(), get_self().value);
+    offer_ids_t.set(offer_ids_table{ offers_t.available_primary_key() }, _self);
+  }
+
+  offer_ids_table offer_ids = offer_ids_t.get();
+
+  uint64_t id = offer_ids.next_id;
+  offer_ids.next_id += 1;
+  offer_ids_t.set(offer_ids, _self);
+
+  return id;
+}
+
+void escrow::offer_not_found(const uint64_t & offer_id, const name & offer_type)
+{
+  offer_tables offers_t(get_self(), get_self().value);
+  check(offers_t.find(offer_id) == offers_t.end(), "offer has not been migrated yet");
+
+  // sell and buy offers share the id sequence, so a miss in one table may be a hit in the other
+  if (offer_type == offer_type_buy)
+  {
+    check(find_offer_partition<sell_offer_tables>(offer_id) == name(), "offer is not a buy offer");
+    check(false, "buy offer not found");
+  }
+
+  check(find_offer_partition<buy_offer_tables>(offer_id) == name(), "offer is not a sell offer");
+  check(false, "sell offer not found");
+}
+
+void escrow::update_market_filters(const sell_offer_table & offer, const name & partition)
+{
+  payment_filter_tables payfilters_t(get_self(), get_self().value);
+
+  if (partition == offer_partition_open)
+  {
+    for (const auto & [payment_method, value] : offer.payment_methods)
+    {
+      payfilters_t.emplace(_self, [&](auto & filter){
+        filter.id = payfilters_t.available_primary_key();
+        filter.sell_offer_id = offer.id;
+        filter.fiat_currency = offer.fiat_currency;
+        filter.payment_method_hash = util::hash_string(payment_method);
+      });
+    }
+    return;
+  }
+
+  auto filters_by_sell_offer = payfilters_t.get_index<name("bysellid")>();
+  auto fitr = filters_by_sell_offer.lower_bound(offer.id);
+
+  while (fitr != filters_by_sell_offer.end() && fitr->sell_offer_id == offer.id)
+  {
+    fitr = filters_by_sell_offer.erase(fitr);
+  }
+}
+
+uint8_t escrow::get_status_index(const sell_offer_table & offer, const name & status)
+{
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    if (sell_offer_statuses[i] == status) return i;
+  }
+  check(false, "unknown sell offer status");
+  return 0;
+}
+
+uint8_t escrow::get_status_index(const buy_offer_table & offer, const name & status)
+{
+  for (uint8_t i = 0; i < 9; i++)
+  {
+    if (buy_offer_statuses[i] == status) return i;
   }
+  check(false, "unknown buy offer status");
+  return 0;
+}
+
+name escrow::get_offer_partition(const name & status)
+{
+  if (status == sell_offer_status_active || status == buy_offer_status_pending)
+  {
+    return offer_partition_open;
+  }
+
+  if (status == sell_offer_status_canceled ||
+    status == sell_offer_status_successful ||
+    status == buy_offer_status_rejected ||
+    status == buy_offer_status_successful ||
+    status == buy_offer_status_flagged)
+  {
+    return offer_partition_terminal;
+  }
+
+  return offer_partition_inflight;
+}
+
+name escrow::get_sell_offer_partition(const uint64_t & sell_offer_id)
+{
+  name partition = find_offer_partition<sell_offer_tables>(sell_offer_id);
+  if (partition == name()) offer_not_found(sell_offer_id, offer_type_sell);
+  return partition;
+}
+
+name escrow::get_buy_offer_partition(const uint64_t & buy_offer_id)
+{
+  name partition = find_offer_partition<buy_offer_tables>(buy_offer_id);
+  if (partition == name()) offer_not_found(buy_offer_id, offer_type_buy);
+  return partition;
+}
+
+std::vector<std::pair<name, name>> escrow::get_reset_plan(const bool & offers_only)
+{
+  std::vector<std::pair<name, name>> plan;
+
+  if (!offers_only)
+  {
+    plan.push_back({ name("users"), get_self() });
+    plan.push_back({ name("ledger"), get_self() });
+    plan.push_back({ name("leaderboard"), leaderboard_total });
+    plan.push_back({ name("leaderboard"), leaderboard_sell });
+    plan.push_back({ name("leaderboard"), leaderboard_buy });
+    plan.push_back({ name("lbstate"), get_self() });
+    plan.push_back({ name("rankcursor"), get_self() });
+    plan.push_back({ name("balances"), get_self() });
+    plan.push_back({ name("trxstats"), get_self() });
+  }
+
+  plan.push_back({ name("offers"), get_self() });
+
+  for (const name & partition : offer_partitions)
+  {
+    plan.push_back({ name("selloffers"), partition });
+    plan.push_back({ name("buyoffers"), partition });
+  }
+
+  plan.push_back({ name("offerids"), get_self() });
+  plan.push_back({ name("prunestate"), get_self() });
+  plan.push_back({ name("buysellrel"), get_self() });
+  plan.push_back({ name("payfilters"), get_self() });
+
+  if (!offers_only)
+  {
+    plan.push_back({ name("arbitoffs"), get_self() });
+    plan.push_back({ name("pmessages"), get_self() });
+    plan.push_back({ name("msganchors"), get_self() });
+    plan.push_back({ name("msgprune"), get_self() });
+    plan.push_back({ name("userspkeys"), get_self() });
+    plan.push_back({ name("seedsstatus"), get_self() });
+    plan.push_back({ name("pricesnap"), get_self() });
+  }
+
+  return plan;
+}
+
+uint64_t escrow::erase_table_rows(const name & table, const name & scope, const uint64_t & max_rows)
+{
+  switch (table.value)
+  {
+    case name("users").value:
+      return erase_rows<user_tables>(scope, max_rows);
+    case name("ledger").value:
+      return erase_rows<ledger_tables>(scope, max_rows);
+    case name("leaderboard").value:
+      return erase_rows<leaderboard_tables>(scope, max_rows);
+    case name("lbstate").value:
+      return erase_rows<leaderboard_state_tables>(scope, max_rows);
+    case name("rankcursor").value:
+    {
+      rank_cursor_tables rank_cursor_t(get_self(), scope.value);
+      rank_cursor_t.remove();
+      return 0;
+    }
+    case name("balances").value:
+      return erase_rows<balances_tables>(scope, max_rows);
+    case name("trxstats").value:
+      return erase_rows<transactions_stats_tables>(scope, max_rows);
+    case name("offers").value:
+      return erase_rows<offer_tables>(scope, max_rows);
+    case name("selloffers").value:
+      return erase_rows<sell_offer_tables>(scope, max_rows);
+    case name("buyoffers").value:
+      return erase_rows<buy_offer_tables>(scope, max_rows);
+    case name("buysellrel").value:
+      return erase_rows<buy_sell_relation_tables>(scope, max_rows);
+    case name("payfilters").value:
+      return erase_rows<payment_filter_tables>(scope, max_rows);
+    case name("arbitoffs").value:
+      return erase_rows<arbitrage_tables>(scope, max_rows);
+    case name("pmessages").value:
+      return erase_rows<private_message_tables>(scope, max_rows);
+    case name("msganchors").value:
+      return erase_rows<message_anchor_tables>(scope, max_rows);
+    case name("userspkeys").value:
+      return erase_rows<user_public_key_tables>(scope, max_rows);
+    case name("seedsstatus").value:
+      return erase_rows<seeds_status_tables>(scope, max_rows);
+    case name("offerids").value:
+    {
+      offer_ids_tables offer_ids_t(get_self(), scope.value);
+      offer_ids_t.remove();
+      return 0;
+    }
+    case name("prunestate").value:
+    {
+      prune_state_tables prune_state_t(get_self(), scope.value);
+      prune_state_t.remove();
+      return 0;
+    }
+    case name("msgprune").value:
+    {
+      message_prune_state_tables message_prune_state_t(get_self(), scope.value);
+      message_prune_state_t.remove();
+      return 0;
+    }
+    case name("pricesnap").value:
+    {
+      price_snapshot_tables price_snapshot_t(get_self(), scope.value);
+      price_snapshot_t.remove();
+      return 0;
+    }
+  }
+
+  check(false, "unknown table " + table.to_string());
+  return 0;
 }
@@ -0,0 +1,306 @@
+const assert = require('assert')
+const fs = require('fs')
+const { join } = require('path')
+const { rpc, transact } = require('../../scripts/eos')
+const { getContracts } = require('../../scripts/eosio-util')
+const { getAllRows } = require('../../scripts/escrow-util')
+const { getSeedsContracts, seedsContracts, seedsAccounts } = require('../../scripts/seeds-util')
+const { contractNames, isLocalNode, sleep } = require('../../scripts/config')
+const { setParamsValue } = require('../../scripts/contract-settings')
+
+const { escrow } = contractNames
+const { firstuser, seconduser, thirduser } = seedsAccounts
+
+// offers seeded before each pass, half sell offers and half pending buy offers on them
+const sizes = (process.env.BENCH_SIZES || '100,10000,100000').split(',').map(Number)
+
+// allowed relative increase over the baseline, cpu also gets an absolute slack for timing noise
+const threshold = Number(process.env.BENCH_THRESHOLD || 0.1)
+const cpuSlackUs = Number(process.env.BENCH_CPU_SLACK_US || 50)
+
+const reportPath = process.env.BENCH_REPORT || join(__dirname, 'report.json')
+const baselinePath = process.env.BENCH_BASELINE || join(__dirname, 'baseline.json')
+
+const seedBatch = 50
+const memo = 'benchmark'
+const iv = '4251f90f2a58a4cf78bf70f95e4f772f'
+const ephemKey = 'PUB_K1_6utVJ2S4zHZCiJvTxDhRVUst5RM5zB8foUaCEqEw34dz9wFh5v'
+const message = '69e4210d9a46daf32bb01bd999770d23f5953b030ea53c93dd7e8f881907d57d'
+const mac = 'a350ac97f1d22e7cb2abaa4ab47a626768d0835e5aa2f6a7ed140bcd46d50165'
+
+function toSeeds (amount) {
+  return `${(amount / 10000).toFixed(4)} SEEDS`
+}
+
+function action (account, name, data, actor) {
+  return { account, name, authorization: [{ actor, permission: 'active' }], data }
+}
+
+async function push (name, data, actor, account = escrow) {
+  return transact({ actions: [action(account, name, data, actor)] })
+}
+
+// billed cpu, wall time, net and the ram delta of every account, inline actions included
+function usageOf ({ processed }) {
+  return {
+    cpu_us: processed.receipt.cpu_usage_us,
+    elapsed_us: processed.elapsed,
+    net_bytes: processed.net_usage,
+    ram_delta: processed.action_traces.reduce((total, trace) =>
+      total + (trace.account_ram_deltas || []).reduce((sum, { delta }) => sum + delta, 0), 0)
+  }
+}
+
+async function nextOfferId () {
+  const res = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'offerids', json: true, limit: 1 })
+  return res.rows.length ? res.rows[0].next_id : 0
+}
+
+// chunked so it also empties the tables left by the largest pass
+async function resetEscrow () {
+  let done = false
+  while (!done) {
+    await push('resetchunk', { max_rows: 500, offers_only: false }, escrow)
+    const state = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'resetstate', json: true, limit: 1 })
+    done = state.rows.length === 0
+  }
+}
+
+async function seedOffers (size) {
+  const pairs = Math.floor(size / 2)
+
+  for (let start = 0; start < pairs; start += seedBatch) {
+    const count = Math.min(seedBatch, pairs - start)
+    const firstId = await nextOfferId()
+    const sellActions = []
+    const buyActions = []
+
+    for (let i = 0; i < count; i++) {
+      // memo keeps consecutive batches from being duplicate transactions
+      sellActions.push(action(escrow, 'addselloffer', {
+        seller: firstuser, total_offered: toSeeds(2), price_percentage: 11000 + start + i, memo: `seed ${start + i}`
+      }, firstuser))
+      buyActions.push(action(escrow, 'addbuyoffer', {
+        buyer: seconduser, sell_offer_id: firstId + i, quantity: toSeeds(1), payment_method: 'paypal', memo: `seed ${start + i}`
+      }, seconduser))
+    }
+
+    await transact({ actions: sellActions })
+    await transact({ actions: buyActions })
+  }
+}
+
+function findRegressions (report, baseline) {
+  const regressions = []
+
+  for (const size of Object.keys(report.results)) {
+    const baseActions = baseline.results[size] || {}
+
+    for (const [name, usage] of Object.entries(report.results[size])) {
+      const base = baseActions[name]
+      if (!base) continue
+
+      if (usage.error || base.error) {
+        if (usage.error && !base.error) regressions.push(`${name} with ${size} offers now fails: ${usage.error}`)
+        continue
+      }
+
+      for (const metric of ['cpu_us', 'net_bytes', 'ram_delta']) {
+        const slack = metric === 'cpu_us' ? cpuSlackUs : 0
+        const limit = base[metric] + Math.abs(base[metric]) * threshold + slack
+        if (usage[metric] > limit) {
+          regressions.push(`${name} with ${size} offers: ${metric} ${base[metric]} -> ${usage[metric]}`)
+        }
+      }
+    }
+  }
+
+  return regressions
+}
+
+describe('Escrow resource usage', async function () {
+  this.timeout(0)
+
+  let seeds
+  const report = { generated_at: new Date().toISOString(), threshold, sizes, results: {} }
+
+  before(async function () {
+    if (!isLocalNode()) {
+      console.log('The benchmark should only be run on local node')
+      process.exit(1)
+    }
+
+    await getContracts([escrow])
+    seeds = await getSeedsContracts([seedsContracts.token, seedsContracts.accounts])
+
+    const info = await rpc.get_info()
+    report.server_version = info.server_version_string
+  })
+
+  for (const size of sizes) {
+    it(`Measure every action with ${size} offers`, async function () {
+      const results = report.results[size] = {}
+
+      // failures are part of the report, a table size can push an action over the limits.
+      // The pass goes on to measure the other actions and fails at the end.
+      const failures = []
+      const record = async (name, data, actor, account = escrow) => {
+        try {
+          results[name] = usageOf(await push(account === escrow ? name : 'transfer', data, actor, account))
+        } catch (error) {
+          results[name] = { error: error.message }
+          failures.push(`${name}: ${error.message}`)
+        }
+        console.log(size, name, JSON.stringify(results[name]))
+      }
+
+      console.log(`seed ${size} offers`)
+      await resetEscrow()
+      await seeds.accounts.reset({ authorization: `${seedsContracts.accounts}@active` })
+
+      for (const user of [firstuser, seconduser, thirduser]) {
+        await seeds.accounts.adduser(user, user, 'individual', { authorization: `${seedsContracts.accounts}@active` })
+      }
+      await seeds.accounts.testresident(firstuser, { authorization: `${seedsContracts.accounts}@active` })
+      await seeds.accounts.testcitizen(seconduser, { authorization: `${seedsContracts.accounts}@active` })
+
+      await setParamsValue()
+
+      await push('upsertuser', { account: seconduser, contact_methods: [{ key: 'signal', value: '987654321' }], payment_methods: [{ key: 'paypal', value: 'url2' }], time_zone: 'gmt', fiat_currency: 'mxn', memo }, seconduser)
+      await push('upsertuser', { account: thirduser, contact_methods: [{ key: 'signal', value: '123456789' }], payment_methods: [{ key: 'paypal', value: 'url3' }], time_zone: 'udt', fiat_currency: 'eur', memo }, thirduser)
+      await record('upsertuser', { account: firstuser, contact_methods: [{ key: 'signal', value: '123456789' }], payment_methods: [{ key: 'paypal', value: 'url' }], time_zone: 'gmt', fiat_currency: 'usd', memo }, firstuser)
+
+      await record('deposit', { from: firstuser, to: escrow, quantity: toSeeds(Math.floor(size / 2) * 2 + 10000000), memo: '' }, firstuser, seedsContracts.token)
+      await seedOffers(size)
+
+      console.log('measure')
+      await record('setparam', { key: 'b.accpt.lim', value: ['uint64', 0], description: '' }, escrow)
+      await push('setparam', { key: 'b.confrm.lim', value: ['uint64', 0], description: '' }, escrow)
+      await record('addpublickey', { account: firstuser, public_key: ephemKey, memo }, firstuser)
+
+      const sellId = await nextOfferId()
+      await record('addselloffer', { seller: firstuser, total_offered: toSeeds(1000000), price_percentage: 10000, memo }, firstuser)
+
+      const addBuyOffer = async (sellOfferId = sellId) => {
+        const id = await nextOfferId()
+        await push('addbuyoffer', { buyer: seconduser, sell_offer_id: sellOfferId, quantity: toSeeds(10000), payment_method: 'paypal', memo }, seconduser)
+        return id
+      }
+
+      let buyId = await nextOfferId()
+      await record('addbuyoffer', { buyer: seconduser, sell_offer_id: sellId, quantity: toSeeds(10000), payment_method: 'paypal', memo }, seconduser)
+      await record('addoffermsg', { buy_offer_id: buyId, iv, ephem_key: ephemKey, message, mac, memo }, seconduser)
+      await record('accptbuyoffr', { buy_offer_id: buyId, memo }, firstuser)
+      await record('payoffer', { buy_offer_id: buyId, memo }, seconduser)
+      await record('confrmpaymnt', { buy_offer_id: buyId, memo }, firstuser)
+      await record('getmessages', { buy_offer_id: buyId, cursor: 0, limit: 10 }, seconduser)
+
+      const messages = await getAllRows('pmessages')
+      await record('delprivtemsg', { message_id: messages[messages.length - 1].id, memo }, seconduser)
+
+      buyId = await addBuyOffer()
+      await record('accptbuyoff2', { buy_offer_id: buyId }, firstuser)
+      await record('addoffermsg2', { buy_offer_id: buyId, iv, ephem_key: ephemKey, message, mac }, seconduser)
+      await record('payoffer2', { buy_offer_id: buyId }, seconduser)
+      await record('confrmpaymn2', { buy_offer_id: buyId }, firstuser)
+
+      buyId = await addBuyOffer()
+      await record('rejctbuyoffr', { buy_offer_id: buyId, memo }, firstuser)
+
+      buyId = await addBuyOffer()
+      await record('batchseller', { seller: firstuser, operations: [{ buy_offer_id: buyId, operation: 'accept' }], memo }, firstuser)
+
+      buyId = await addBuyOffer()
+      await sleep(1000)
+      await record('delbuyoffer', { buy_offer_id: buyId, memo }, seconduser)
+
+      await record('marketbuy', { buyer: seconduser, quantity: toSeeds(10000), fiat_currency: 'usd', payment_method: 'paypal', max_price_percentage: 20000, max_matches: 5, memo }, seconduser)
+
+      console.log('arbitrage')
+      await record('addarbiter', { account: thirduser }, escrow)
+
+      const arbitrageIds = []
+      for (let i = 0; i < 2; i++) {
+        buyId = await addBuyOffer()
+        await push('accptbuyoffr', { buy_offer_id: buyId, memo }, firstuser)
+        await push('payoffer', { buy_offer_id: buyId, memo }, seconduser)
+        arbitrageIds.push(buyId)
+      }
+      await sleep(1000)
+
+      await record('initarbitrage', { buy_offer_id: arbitrageIds[0], memo }, seconduser)
+      await push('initarbitrage', { buy_offer_id: arbitrageIds[1], memo }, seconduser)
+      await record('getarbqueue', { cursor: 0, limit: 10 }, seconduser)
+      await record('arbtrgeoffer', { arbiter: thirduser, offer_id: arbitrageIds[0], memo }, thirduser)
+      await push('arbtrgeoffer', { arbiter: thirduser, offer_id: arbitrageIds[1], memo }, thirduser)
+      await record('sendconmethd', { buy_offer_id: arbitrageIds[0], iv, ephem_key: ephemKey, message, mac, memo }, firstuser)
+      await record('resolvesellr', { offer_id: arbitrageIds[0], notes: '', memo }, thirduser)
+      await record('resolvebuyer', { offer_id: arbitrageIds[1], notes: '', memo }, thirduser)
+      await record('delarbiter', { account: thirduser }, escrow)
+
+      console.log('cancel')
+      const cancelId = await nextOfferId()
+      await push('addselloffer', { seller: firstuser, total_offered: toSeeds(100000), price_percentage: 10000, memo }, firstuser)
+      await addBuyOffer(cancelId)
+      await addBuyOffer(cancelId)
+      await push('setparam', { key: 's.cancl.btch', value: ['uint64', 1], description: '' }, escrow)
+      await record('cancelsoffer', { sell_offer_id: cancelId, memo }, firstuser)
+      await record('rejctpending', { sell_offer_id: cancelId }, seconduser)
+
+      console.log('queries and maintenance')
+      await record('getoffers', { filter: { offer_type: 'offer.sell', partition: 'open', seller: '', buyer: '' }, cursor: 0, limit: 10 }, seconduser)
+      await record('getbalance', { account: firstuser }, seconduser)
+      await record('gettrxstats', { account: firstuser }, seconduser)
+      await record('withdraw', { account: firstuser, quantity: toSeeds(10000), memo }, firstuser)
+      await record('prune', { max_rows: 10 }, seconduser)
+      await record('prunemsgs', { max_rows: 10 }, seconduser)
+      await record('sweep', { max_rows: 10 }, seconduser)
+      await record('rankusers', { max_rows: 10 }, seconduser)
+      await record('offerlog', { id: buyId, sell_id: sellId, seller: firstuser, buyer: seconduser, quantity: toSeeds(10000), price_percentage: 10000, fiat_currency: 'usd', status: 'b.success', created_date: '2021-01-01T00:00:00.000', closed_date: '2021-01-01T00:00:00.000' }, escrow)
+      await record('msglog', { id: 0, buy_offer_id: buyId, sender: seconduser, receiver: firstuser, iv, ephem_key: ephemKey, message, mac }, escrow)
+      await record('offerevent', { id: buyId, sell_id: sellId, old_status: 'b.paid', new_status: 'b.success', quantity: toSeeds(10000), date: '2021-01-01T00:00:00.000' }, escrow)
+      await record('balevent', { account: firstuser, available_delta: 0, swap_delta: 0, escrow_delta: -10000 }, escrow)
+      await record('addlgcyoffer', { id: 1000000000, sell_id: 1000000000, seller: firstuser, buyer: '', type: 'offer.sell', quantity: toSeeds(10000), price_percentage: 10000, current_status: 's.active' }, escrow)
+      await record('migrateoffrs', { max_rows: 10 }, escrow)
+      await record('addlgcybal', { account: thirduser, available_balance: toSeeds(10000), swap_balance: toSeeds(0), escrow_balance: toSeeds(0), sell_successful: 1, buy_successful: 1 }, escrow)
+      await record('migrateldgr', { max_rows: 10 }, escrow)
+
+      await record('resetsttngs', {}, escrow)
+      await setParamsValue()
+
+      await record('resetchunk', { max_rows: 100, offers_only: true }, escrow)
+      await record('resetoffers', {}, escrow)
+      await record('reset', {}, escrow)
+
+      assert.deepStrictEqual(failures, [], `actions failed with ${size} offers`)
+    })
+  }
+
+  it('Every action of the contract is measured', async function () {
+    const { abi } = await rpc.get_abi(escrow)
+
+    for (const size of sizes) {
+      const missing = abi.actions.map(({ name }) => name).filter(name => !report.results[size][name])
+      assert.deepStrictEqual(missing, [], `actions without a benchmark with ${size} offers`)
+    }
+  })
+
+  it('Write the report and compare it with the baseline', async function () {
+    fs.writeFileSync(reportPath, JSON.stringify(report, null, 2))
+    console.log(`report written to ${reportPath}`)
+
+    if (process.env.BENCH_UPDATE_BASELINE) {
+      fs.writeFileSync(baselinePath, JSON.stringify(report, null, 2))
+      console.log(`baseline updated at ${baselinePath}`)
+      return
+    }
+
+    if (!fs.existsSync(baselinePath)) {
+      console.log('no baseline to compare with, run with BENCH_UPDATE_BASELINE=1 to create it')
+      return
+    }
+
+    const regressions = findRegressions(report, JSON.parse(fs.readFileSync(baselinePath)))
+    assert.deepStrictEqual(regressions, [], 'resource usage regressed over the baseline')
+  })
+})
@@ -1,6 +1,7 @@
 const assert = require('assert')
 const { rpc } = require('../scripts/eos')
 const { getContracts, getAccountBalance } = require('../scripts/eosio-util')
+const { getOffers, getPartitionedRows, getBestSellOffers, getSellOffersByTimeZone, getSellOffersByPaymentMethod, getEvents, query, getBalances, getTrxStats } = require('../scripts/escrow-util')
 const { getSeedsContracts, seedsContracts, seedsAccounts, seedsSymbol } = require('../scripts/seeds-util')
 const { assertError } = require('../scripts/eosio-errors')
 const { contractNames, isLocalNode, sleep } = require('../scripts/config')
@@ -117,13 +118,7 @@ describe('Escrow', async function () {
     assert.deepStrictEqual(firstuserBalanceAfter - firstuserBalanceBefore, 1000.0)
     assert.deepStrictEqual(onlyAvailableBalance, true)
 
-    const escrowBalances = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'balances',
-      json: true,
-      limit: 100
-    })
+    const escrowBalances = await getBalances()
 
     assert.deepStrictEqual(escrowBalances.rows, [
       {
@@ -137,11 +132,32 @@ describe('Escrow', async function () {
         available_balance: '2000.0000 SEEDS',
         swap_balance: '0.0000 SEEDS',
         escrow_balance: '0.0000 SEEDS'
+      },
+      {
+        account: thirduser,
+        available_balance: '0.0000 SEEDS',
+        swap_balance: '0.0000 SEEDS',
+        escrow_balance: '0.0000 SEEDS'
       }
     ])
 
   })
 
+  it('Seeds user status is cached', async function () {
+    const cachedStatus = async (account) => {
+      const res = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'seedsstatus', json: true, lower_bound: account, upper_bound: account, limit: 1 })
+      return res.rows.length > 0 ? res.rows[0].status : null
+    }
+
+    assert.deepStrictEqual(await cachedStatus(thirduser), 'visitor')
+
+    console.log('a promotion is picked up before the cached status expires')
+    await seeds.accounts.testresident(thirduser, { authorization: `${seedsContracts.accounts}@active` })
+    await seeds.token.transfer(thirduser, escrow, '10.0000 SEEDS', '', { authorization: `${thirduser}@active` })
+
+    assert.deepStrictEqual(await cachedStatus(thirduser), 'resident')
+  })
+
   it('Sell offers', async function () {
 
     await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
@@ -178,13 +194,7 @@ describe('Escrow', async function () {
 
     await contracts.escrow.addselloffer(firstuser, '1000.0000 SEEDS', 9300, hyperionMemo, { authorization: `${firstuser}@active` })
 
-    const sellOffers = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })  
+    const sellOffers = await getOffers()  
     
     it('Cancels sell offer', async function () {
 
@@ -205,13 +215,7 @@ describe('Escrow', async function () {
 
       await contracts.escrow.cancelsoffer(0, hyperionMemo, { authorization: `${seconduser}@active` })
 
-      const sellOffers = await rpc.get_table_rows({
-        code: escrow,
-        scope: escrow,
-        table: 'offers',
-        json: true,
-        limit: 100
-      })
+      const sellOffers = await getOffers()
 
       console.log(JSON.stringify(sellOffers, null, 2))
 
@@ -411,13 +415,7 @@ describe('Escrow', async function () {
       })
     }
     // print table to see soldout status
-    const sellOffers = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const sellOffers = await getOffers()
 
     console.log(JSON.stringify(sellOffers, null, 2))
     
@@ -498,17 +496,491 @@ describe('Escrow', async function () {
 
     await contracts.escrow.cancelsoffer(0, hyperionMemo, { authorization: `${seconduser}@active` })
 
+    const sellOffers = await getOffers()
+
+    console.log(JSON.stringify(sellOffers, null, 2))
+  })
+
+  it('Offers created in the same window share a price snapshot', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.addselloffer(firstuser, '100.0000 SEEDS', 10000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '100.0000 SEEDS', 10000, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    const snapshot = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'pricesnap', json: true, limit: 1 })
+    const price = await rpc.get_table_rows({ code: 'tlosto.seeds', scope: 'tlosto.seeds', table: 'price', json: true, limit: 1 })
+    const sellOffers = await getPartitionedRows('selloffers')
+
+    assert.deepStrictEqual(snapshot.rows[0].seeds_per_usd, price.rows[0].current_seeds_per_usd)
+    assert.deepStrictEqual(snapshot.rows[0].round_id, price.rows[0].current_round_id)
+    assert.deepStrictEqual(sellOffers[0].seeds_per_usd, sellOffers[1].seeds_per_usd)
+  })
+
+  it('Cancel sell offer rejects pending buy offers in batches', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '500.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    for (let i = 0; i < 3; i++) {
+      await contracts.escrow.addbuyoffer(seconduser, 0, `${i + 1}0.0000 SEEDS`, 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    }
+
+    await contracts.escrow.setparam('s.cancl.btch', ['uint64', 2], '', { authorization: `${escrow}@active` })
+    await contracts.escrow.cancelsoffer(0, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    const statuses = async () => (await getPartitionedRows('buyoffers')).map(offer => offer.current_status)
+
+    console.log('the sell offer is canceled at once, only the first batch is rejected')
+    assert.deepStrictEqual((await getPartitionedRows('selloffers'))[0].current_status, 's.canceled')
+    assert.deepStrictEqual(await statuses(), ['b.rejected', 'b.rejected', 'b.pending'])
+
+    let onlyActiveOffers = true
+    try {
+      await contracts.escrow.cancelsoffer(0, hyperionMemo, { authorization: `${firstuser}@active` })
+      onlyActiveOffers = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'can not cancel the sell offer, it is not active',
+        message: 'can not cancel the sell offer, it is not active (expected)',
+        throwError: true
+      })
+    }
+
+    console.log('until rejctpending runs the pending buy offer can not be accepted')
+    let notAccepted = true
+    try {
+      await contracts.escrow.accptbuyoffr(2, hyperionMemo, { authorization: `${firstuser}@active` })
+      notAccepted = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'sell offer does not have enough funds',
+        message: 'sell offer does not have enough funds (expected)',
+        throwError: true
+      })
+    }
+
+    let noNewOffers = true
+    try {
+      await contracts.escrow.addbuyoffer(seconduser, 0, '10.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+      noNewOffers = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'sell offer does not have enough funds',
+        message: 'sell offer does not have enough funds (expected)',
+        throwError: true
+      })
+    }
+
+    assert.deepStrictEqual(await statuses(), ['b.rejected', 'b.rejected', 'b.pending'])
+
+    await contracts.escrow.rejctpending(0, { authorization: `${fourthuser}@active` })
+    assert.deepStrictEqual(await statuses(), ['b.rejected', 'b.rejected', 'b.rejected'])
+
+    let nothingLeft = true
+    try {
+      await contracts.escrow.rejctpending(0, { authorization: `${fourthuser}@active` })
+      nothingLeft = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'sell offer has no pending buy offers',
+        message: 'sell offer has no pending buy offers (expected)',
+        throwError: true
+      })
+    }
+
+    let batchNotZero = true
+    try {
+      await contracts.escrow.setparam('s.cancl.btch', ['uint64', 0], '', { authorization: `${escrow}@active` })
+      batchNotZero = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'the s.cancl.btch parameter must be greater than 0',
+        message: 'the s.cancl.btch parameter must be greater than 0 (expected)',
+        throwError: true
+      })
+    }
+
+    await setParamsValue()
+
+    assert.deepStrictEqual(onlyActiveOffers, true)
+    assert.deepStrictEqual(notAccepted, true)
+    assert.deepStrictEqual(noNewOffers, true)
+    assert.deepStrictEqual(nothingLeft, true)
+    assert.deepStrictEqual(batchNotZero, true)
+  })
+
+  it('Batch seller operations', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '600.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.addbuyoffer(seconduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '200.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addbuyoffer(thirduser, 0, '300.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${thirduser}@active` })
+
+    await contracts.escrow.batchseller(firstuser, [
+      { buy_offer_id: 1, operation: 'accept' },
+      { buy_offer_id: 2, operation: 'accept' },
+      { buy_offer_id: 3, operation: 'reject' }
+    ], hyperionMemo, { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.payoffer(1, hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.payoffer(2, hyperionMemo, { authorization: `${seconduser}@active` })
+
+    const buyerBalanceBefore = await getAccountBalance(seedsContracts.token, seconduser, seedsSymbol)
+
+    await contracts.escrow.batchseller(firstuser, [
+      { buy_offer_id: 1, operation: 'confirm' },
+      { buy_offer_id: 2, operation: 'confirm' }
+    ], hyperionMemo, { authorization: `${firstuser}@active` })
+
+    const buyerBalanceAfter = await getAccountBalance(seedsContracts.token, seconduser, seedsSymbol)
+
+    console.log('a batch of rejections does not emit a balance event')
+    await contracts.escrow.addbuyoffer(thirduser, 0, '50.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${thirduser}@active` })
+    const rejectRes = await contracts.escrow.batchseller(firstuser, [
+      { buy_offer_id: 4, operation: 'reject' }
+    ], hyperionMemo, { authorization: `${firstuser}@active` })
+
+    const buyOffers = await getPartitionedRows('buyoffers')
+    const balances = await getBalances()
+
+    assert.deepStrictEqual(buyOffers.map(offer => offer.current_status), ['b.success', 'b.success', 'b.rejected', 'b.rejected'])
+    assert.deepStrictEqual(getEvents(rejectRes).map(({ name }) => name), ['offerevent'])
+    assert.deepStrictEqual(buyerBalanceAfter - buyerBalanceBefore, 300)
+    assert.deepStrictEqual(balances.rows[0].swap_balance, '300.0000 SEEDS')
+    assert.deepStrictEqual(balances.rows[0].escrow_balance, '0.0000 SEEDS')
+  })
+
+  it('Market filters by time zone and payment method', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await seeds.token.transfer(seconduser, escrow, '1000.0000 SEEDS', '', { authorization: `${seconduser}@active` })
+
+    await contracts.escrow.upsertuser(seconduser, [{'key': 'signal', 'value': '987654321'}], [{'key': 'paypal', 'value': 'url2'}, {'key': 'zelle', 'value': 'url5'}], 'utc', 'usd', hyperionMemo, { authorization: `${seconduser}@active` })
+
+    await contracts.escrow.addselloffer(firstuser, '300.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(seconduser, '500.0000 SEEDS', 10000, hyperionMemo, { authorization: `${seconduser}@active` })
+
+    const ids = offers => offers.map(offer => offer.id)
+
+    assert.deepStrictEqual(ids(await getSellOffersByTimeZone('usd', 'gmt')), [0])
+    assert.deepStrictEqual(ids(await getSellOffersByTimeZone('usd', 'utc')), [1])
+    assert.deepStrictEqual(ids(await getSellOffersByPaymentMethod('usd', 'paypal')), [0, 1])
+    assert.deepStrictEqual(ids(await getSellOffersByPaymentMethod('usd', 'zelle')), [1])
+    assert.deepStrictEqual(ids(await getSellOffersByPaymentMethod('mxn', 'paypal')), [])
+
+    console.log('a canceled sell offer leaves the filters')
+    await contracts.escrow.cancelsoffer(1, hyperionMemo, { authorization: `${seconduser}@active` })
+
+    assert.deepStrictEqual(ids(await getSellOffersByPaymentMethod('usd', 'paypal')), [0])
+    assert.deepStrictEqual(ids(await getSellOffersByPaymentMethod('usd', 'zelle')), [])
+    assert.deepStrictEqual(ids(await getSellOffersByTimeZone('usd', 'utc')), [])
+  })
+
+  it('Transitions emit offer and balance events', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+
+    const sellRes = await contracts.escrow.addselloffer(firstuser, '300.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '300.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    const acceptRes = await contracts.escrow.accptbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    const summary = events => events.map(({ name, data }) => name === 'offerevent'
+      ? [name, data.id, data.old_status, data.new_status, data.quantity]
+      : [name, data.account, data.available_delta, data.swap_delta, data.escrow_delta])
+
+    assert.deepStrictEqual(summary(getEvents(sellRes)), [
+      ['balevent', firstuser, -3000000, 3000000, 0],
+      ['offerevent', 0, '', 's.active', '300.0000 SEEDS']
+    ])
+
+    console.log('accepting the whole offer also sells it out')
+    assert.deepStrictEqual(summary(getEvents(acceptRes)), [
+      ['offerevent', 1, 'b.pending', 'b.accepted', '300.0000 SEEDS'],
+      ['offerevent', 0, 's.active', 's.soldout', '0.0000 SEEDS'],
+      ['balevent', firstuser, 0, -3000000, 3000000]
+    ])
+
+    console.log('a partial accept reports what is left of the sell offer')
+    await contracts.escrow.addselloffer(firstuser, '300.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 2, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    const partialRes = await contracts.escrow.accptbuyoffr(3, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    assert.deepStrictEqual(summary(getEvents(partialRes)), [
+      ['offerevent', 3, 'b.pending', 'b.accepted', '100.0000 SEEDS'],
+      ['offerevent', 2, 's.active', 's.active', '200.0000 SEEDS'],
+      ['balevent', firstuser, 0, -1000000, 1000000]
+    ])
+  })
+
+  it('Compact v2 trade actions', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '300.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+
+    const mac = 'a350ac97f1d22e7cb2abaa4ab47a626768d0835e5aa2f6a7ed140bcd46d50165'
+
+    await contracts.escrow.accptbuyoff2(1, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addoffermsg2(1, 'iv', 'key', 'paid', mac, { authorization: `${seconduser}@active` })
+    await contracts.escrow.payoffer2(1, { authorization: `${seconduser}@active` })
+    await contracts.escrow.confrmpaymn2(1, { authorization: `${firstuser}@active` })
+
+    const buyOffers = await getPartitionedRows('buyoffers')
+    const messages = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'pmessages', json: true, limit: 10 })
+
+    assert.deepStrictEqual(buyOffers[0].current_status, 'b.success')
+    assert.deepStrictEqual(messages.rows.map(row => [row.sender, row.message]), [[seconduser, 'paid']])
+
+    let sellerOnly = true
+    try {
+      await contracts.escrow.accptbuyoff2(1, { authorization: `${seconduser}@active` })
+      sellerOnly = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'status is not pending',
+        message: 'the v2 action keeps the checks of accptbuyoffr (expected)',
+        throwError: true
+      })
+    }
+
+    assert.deepStrictEqual(sellerOnly, true)
+  })
+
+  it('Market buy fills from the cheapest sell offers', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await seeds.token.transfer(seconduser, escrow, '1000.0000 SEEDS', '', { authorization: `${seconduser}@active` })
+
+    await contracts.escrow.addselloffer(firstuser, '300.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '200.0000 SEEDS', 10500, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '500.0000 SEEDS', 13000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(seconduser, '500.0000 SEEDS', 10000, hyperionMemo, { authorization: `${seconduser}@active` })
+
+    const orderBook = await getBestSellOffers('usd', 2)
+    assert.deepStrictEqual(orderBook.map(offer => offer.id), [1, 0])
+
+    await contracts.escrow.marketbuy(thirduser, '400.0000 SEEDS', 'usd', 'paypal', 12000, 5, hyperionMemo, { authorization: `${thirduser}@active` })
+
+    const buyOffers = await getPartitionedRows('buyoffers')
+
+    console.log('the mxn offer and the one above the maximum price are skipped')
+    assert.deepStrictEqual(buyOffers.map(offer => [offer.sell_id, offer.quantity]), [
+      [1, '200.0000 SEEDS'],
+      [0, '200.0000 SEEDS']
+    ])
+
+    let onlyMatches = true
+    try {
+      await contracts.escrow.marketbuy(thirduser, '100.0000 SEEDS', 'eur', 'paypal', 12000, 5, hyperionMemo, { authorization: `${thirduser}@active` })
+      onlyMatches = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'no sell offer matches the market buy',
+        message: 'no sell offer matches the market buy (expected)',
+        throwError: true
+      })
+    }
+
+    assert.deepStrictEqual(onlyMatches, true)
+  })
+
+  it('Query actions return pages of offers', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '500.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.addbuyoffer(seconduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addbuyoffer(thirduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${thirduser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '200.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+
+    const filter = { offer_type: 'offer.buy', partition: 'open', seller: '', buyer: seconduser }
+
+    const firstPage = await query('getoffers', { filter, cursor: 0, limit: 1 }, seconduser)
+    assert.deepStrictEqual(firstPage.offers.map(offer => offer.id), [1])
+    assert.deepStrictEqual(firstPage.more, true)
+
+    const secondPage = await query('getoffers', { filter, cursor: firstPage.next_cursor, limit: 1 }, seconduser)
+    assert.deepStrictEqual(secondPage.offers.map(offer => [offer.id, offer.quantity]), [[3, '200.0000 SEEDS']])
+    assert.deepStrictEqual(secondPage.more, false)
+
+    const noMatches = await query('getoffers', { filter: { ...filter, seller: thirduser }, cursor: 0, limit: 10 }, seconduser)
+    assert.deepStrictEqual(noMatches, { offers: [], next_cursor: 0, more: false })
+
+    const queue = await query('getarbqueue', { cursor: 0, limit: 10 }, seconduser)
+    assert.deepStrictEqual(queue.arbitrages, [])
+
+    const balance = await query('getbalance', { account: firstuser }, seconduser)
+    assert.deepStrictEqual(balance, {
+      account: firstuser,
+      available_balance: '500.0000 SEEDS',
+      swap_balance: '500.0000 SEEDS',
+      escrow_balance: '0.0000 SEEDS'
+    })
+  })
+
+  it('Sell and buy offers are stored in typed tables', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.addselloffer(firstuser, '600.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '250.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.accptbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
+
     const sellOffers = await rpc.get_table_rows({
       code: escrow,
-      scope: escrow,
-      table: 'offers',
+      scope: 'open',
+      table: 'selloffers',
       json: true,
       limit: 100
     })
 
-    console.log(JSON.stringify(sellOffers, null, 2))
+    const buyOffers = await rpc.get_table_rows({
+      code: escrow,
+      scope: 'inflight',
+      table: 'buyoffers',
+      json: true,
+      limit: 100
+    })
+
+    assert.deepStrictEqual(sellOffers.rows[0].id, 0)
+    assert.deepStrictEqual(sellOffers.rows[0].total_offered, '600.0000 SEEDS')
+    assert.deepStrictEqual(sellOffers.rows[0].available, '350.0000 SEEDS')
+    assert.deepStrictEqual(sellOffers.rows[0].price_percentage, 11000)
+
+    assert.deepStrictEqual(buyOffers.rows[0].id, 1)
+    assert.deepStrictEqual(buyOffers.rows[0].sell_id, 0)
+    assert.deepStrictEqual(buyOffers.rows[0].quantity, '250.0000 SEEDS')
+    assert.deepStrictEqual(buyOffers.rows[0].payment_method, 'paypal')
+    assert.deepStrictEqual(buyOffers.rows[0].current_status, 'b.accepted')
+
+    console.log('legacy view of the offers')
+    const offers = await getOffers()
+
+    assert.deepStrictEqual(offers.rows[0].type, 'offer.sell')
+    assert.deepStrictEqual(offers.rows[0].quantity_info.find(el => el.key === 'available').value, '350.0000 SEEDS')
+    assert.deepStrictEqual(offers.rows[1].type, 'offer.buy')
+    assert.deepStrictEqual(offers.rows[1].quantity_info.find(el => el.key === 'buyquantity').value, '250.0000 SEEDS')
+    assert.deepStrictEqual(offers.rows[1].payment_methods, [{ key: 'paypal', value: 'url' }])
+  })
+
+  it('Offers move between lifecycle partitions', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.addselloffer(firstuser, '500.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '500.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addbuyoffer(thirduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${thirduser}@active` })
+
+    const partitionOf = async (table, id) => {
+      for (const scope of ['open', 'inflight', 'terminal']) {
+        const res = await rpc.get_table_rows({ code: escrow, scope, table, json: true, lower_bound: id, upper_bound: id, limit: 1 })
+        if (res.rows.length > 0) return scope
+      }
+      return null
+    }
+
+    assert.deepStrictEqual(await partitionOf('selloffers', 0), 'open')
+    assert.deepStrictEqual(await partitionOf('buyoffers', 1), 'open')
+
+    assert.deepStrictEqual((await getPartitionedRows('selloffers'))[0].open_buy_offers, 2)
+
+    await contracts.escrow.accptbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
+    assert.deepStrictEqual(await partitionOf('selloffers', 0), 'inflight')
+    assert.deepStrictEqual(await partitionOf('buyoffers', 1), 'inflight')
+
+    await contracts.escrow.rejctbuyoffr(2, hyperionMemo, { authorization: `${firstuser}@active` })
+    assert.deepStrictEqual(await partitionOf('buyoffers', 2), 'terminal')
+
+    await contracts.escrow.payoffer(1, hyperionMemo, { authorization: `${seconduser}@active` })
+    assert.deepStrictEqual(await partitionOf('buyoffers', 1), 'inflight')
+
+    await contracts.escrow.confrmpaymnt(1, hyperionMemo, { authorization: `${firstuser}@active` })
+    assert.deepStrictEqual(await partitionOf('buyoffers', 1), 'terminal')
+    assert.deepStrictEqual(await partitionOf('selloffers', 0), 'terminal')
+
+    const buyOffers = await getPartitionedRows('buyoffers')
+    assert.deepStrictEqual(buyOffers.map(offer => offer.current_status), ['b.success', 'b.rejected'])
+
+    // status_history keeps one slot per status up to the last one entered
+    assert.deepStrictEqual(buyOffers[0].status_history.visited, 0b100111)
+    assert.deepStrictEqual(buyOffers[0].status_history.dates.length, 6)
+    assert.deepStrictEqual(buyOffers[1].status_history.visited, 0b10001)
+
+    const sellOffers = await getPartitionedRows('selloffers')
+    assert.deepStrictEqual(sellOffers[0].sold, '500.0000 SEEDS')
+    assert.deepStrictEqual(sellOffers[0].open_buy_offers, 0)
+  })
+
+  it('Offers created before the legacy offers are migrated', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.addlgcyoffer(0, 0, firstuser, '', 'offer.sell', '100.0000 SEEDS', 11000, 's.active', { authorization: `${escrow}@active` })
+    await contracts.escrow.addlgcyoffer(1, 0, firstuser, seconduser, 'offer.buy', '50.0000 SEEDS', 11000, 'b.pending', { authorization: `${escrow}@active` })
+
+    console.log('new offers continue after the legacy ids')
+    await contracts.escrow.addselloffer(firstuser, '200.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    assert.deepStrictEqual((await getPartitionedRows('selloffers')).map(offer => offer.id), [2])
+
+    let legacyOfferHidden = true
+    try {
+      await contracts.escrow.addbuyoffer(seconduser, 0, '10.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+      legacyOfferHidden = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'offer has not been migrated yet',
+        message: 'offer has not been migrated yet (expected)',
+        throwError: true
+      })
+    }
+
+    await contracts.escrow.migrateoffrs(10, { authorization: `${escrow}@active` })
+
+    const legacyOffers = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'offers', json: true, limit: 10 })
+    const sellOffers = await getPartitionedRows('selloffers')
+    const buyOffers = await getPartitionedRows('buyoffers')
+
+    await contracts.escrow.addbuyoffer(seconduser, 0, '10.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    const offerIds = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'offerids', json: true, limit: 1 })
+
+    assert.deepStrictEqual(legacyOfferHidden, true)
+    assert.deepStrictEqual(legacyOffers.rows.length, 0)
+    assert.deepStrictEqual(sellOffers.map(offer => offer.id), [0, 2])
+    assert.deepStrictEqual(sellOffers[0].open_buy_offers, 1)
+    assert.deepStrictEqual(buyOffers.map(offer => offer.id), [1])
+    assert.deepStrictEqual(offerIds.rows[0].next_id, 4)
   })
 
+  it('Legacy balances merge into ledger rows created after the upgrade', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.addlgcybal(firstuser, '200.0000 SEEDS', '50.0000 SEEDS', '25.0000 SEEDS', 3, 1, { authorization: `${escrow}@active` })
+    await contracts.escrow.addlgcybal(fourthuser, '10.0000 SEEDS', '0.0000 SEEDS', '0.0000 SEEDS', 0, 2, { authorization: `${escrow}@active` })
+
+    await contracts.escrow.migrateldgr(10, { authorization: `${escrow}@active` })
+
+    const balances = (await getBalances()).rows
+    const trxStats = (await getTrxStats()).rows
+    const legacyBalances = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'balances', json: true, limit: 10 })
+    const legacyTrxStats = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'trxstats', json: true, limit: 10 })
+
+    assert.deepStrictEqual(balances.find(row => row.account === firstuser), {
+      account: firstuser,
+      available_balance: '1200.0000 SEEDS',
+      swap_balance: '50.0000 SEEDS',
+      escrow_balance: '25.0000 SEEDS'
+    })
+    assert.deepStrictEqual(trxStats.find(row => row.account === firstuser), {
+      account: firstuser,
+      total_trx: 4,
+      sell_successful: 3,
+      buy_successful: 1
+    })
+    assert.deepStrictEqual(balances.find(row => row.account === fourthuser).available_balance, '10.0000 SEEDS')
+    assert.deepStrictEqual(trxStats.find(row => row.account === fourthuser).buy_successful, 2)
+    assert.deepStrictEqual(legacyBalances.rows.length, 0)
+    assert.deepStrictEqual(legacyTrxStats.rows.length, 0)
+  })
 
   it('Add arbiter', async function () {
 
@@ -609,6 +1081,20 @@ describe('Escrow', async function () {
     await contracts.escrow.addselloffer(firstuser, '1000.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
     await contracts.escrow.addbuyoffer(seconduser, 0, '1000.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
     await contracts.escrow.accptbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    let onlyPaidOffers = true
+    try {
+      await contracts.escrow.initarbitrage(1, hyperionMemo, { authorization: `${seconduser}@active` })
+      onlyPaidOffers = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'can not create arbitrage, offer is not marked as paid',
+        message: 'can not create arbitrage, offer is not marked as paid (expected)',
+        throwError: true
+      })
+    }
+
     await contracts.escrow.payoffer(1, hyperionMemo, { authorization: `${seconduser}@active` })
     console.log('paid')
 
@@ -643,24 +1129,20 @@ describe('Escrow', async function () {
     await setParamsValue(true)
     await contracts.escrow.initarbitrage(1, hyperionMemo, { authorization: `${firstuser}@active` })
 
+    let onlyOnce = true
     try {
       await contracts.escrow.initarbitrage(1, hyperionMemo, { authorization: `${firstuser}@active` })
+      onlyOnce = false
     } catch (error) {
       assertError({
         error,
-        textInside: 'arbitrage already exists',
-        message: 'arbitrage already exists (expected)',
+        textInside: 'can not create arbitrage, offer is not marked as paid',
+        message: 'can not create arbitrage, offer is not marked as paid (expected)',
         throwError: true
       })
     }
 
-    const offers = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offers = await getOffers()
 
     const arbitoffs = await rpc.get_table_rows({
       code: escrow,
@@ -692,6 +1174,8 @@ describe('Escrow', async function () {
       }
     ])
     assert.deepStrictEqual(onlyAfter24h, true)
+    assert.deepStrictEqual(onlyPaidOffers, true)
+    assert.deepStrictEqual(onlyOnce, true)
   })
 
   it('Arbitrage offer', async function () {
@@ -767,13 +1251,7 @@ describe('Escrow', async function () {
       }
     ])
 
-    const offers = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offers = await getOffers()
 
     delete offers.rows[1].created_date
 
@@ -799,7 +1277,7 @@ describe('Escrow', async function () {
     await contracts.escrow.accptbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
     await contracts.escrow.accptbuyoffr(2, hyperionMemo, { authorization: `${firstuser}@active` })
 
-    // await contracts.escrow.payoffer(1, { authorization: `${seconduser}@active` })
+    await contracts.escrow.payoffer(1, hyperionMemo, { authorization: `${seconduser}@active` })
     await contracts.escrow.payoffer(2, hyperionMemo, { authorization: `${thirduser}@active` })
 
     try {
@@ -838,23 +1316,11 @@ describe('Escrow', async function () {
     console.log('add arbiter to arbitrage')
     await contracts.escrow.arbtrgeoffer(thirduser, 1, hyperionMemo, { authorization: `${thirduser}@active` })
 
-    const offersB = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offersB = await getOffers()
 
     let currSellOffBefore = offersB.rows[0]
 
-    const balancesB = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'balances',
-      json: true,
-      limit: 100
-    })
+    const balancesB = await getBalances()
 
     console.log('Balances before')
 
@@ -868,13 +1334,7 @@ describe('Escrow', async function () {
     let availabeBefore = currSellOffBefore.quantity_info.find(el => el.key === 'available').value
     let totalOfferedBefore = currSellOffBefore.quantity_info.find(el => el.key === 'totaloffered').value
 
-    const balances = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'balances',
-      json: true,
-      limit: 100
-    })
+    const balances = await getBalances()
 
     console.log('Seller balance before resolve buyoffer 1')
     assert.deepStrictEqual(balances.rows[0],   {
@@ -913,13 +1373,7 @@ describe('Escrow', async function () {
       }
     ])
 
-    const balances2 = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'balances',
-      json: true,
-      limit: 100
-    })
+    const balances2 = await getBalances()
 
     console.log('Seller balance confirm payment of buyoffer 2')
     assert.deepStrictEqual(balances2.rows[0],   {
@@ -931,13 +1385,7 @@ describe('Escrow', async function () {
     
     await contracts.escrow.confrmpaymnt(2, hyperionMemo, { authorization: `${firstuser}@active` })
 
-    const balancesAf = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'balances',
-      json: true,
-      limit: 100
-    })
+    const balancesAf = await getBalances()
 
     assert.deepStrictEqual(balancesAf.rows[0],   {
       "account": firstuser,
@@ -946,13 +1394,7 @@ describe('Escrow', async function () {
       "escrow_balance": "0.0000 SEEDS"
     })
 
-    const offers = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offers = await getOffers()
 
     let currBuyOff = offers.rows[1]
     let currSellOff = offers.rows[0]
@@ -1025,26 +1467,14 @@ describe('Escrow', async function () {
 
     await contracts.escrow.confrmpaymnt(2, hyperionMemo, { authorization: `${firstuser}@active` })
     
-    const offers = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offers = await getOffers()
 
     let currSellOff = offers.rows.find(el => el.id === 0)
     assert.deepStrictEqual(currSellOff.current_status, 's.soldout')
 
     await contracts.escrow.resolvebuyer(1, "Resolved to buyer", hyperionMemo, { authorization: `${thirduser}@active` })
 
-    const offersAf = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offersAf = await getOffers()
 
     console.log('Sell offer is s.successful because all other buy offers are as b.success and buy offer was resolved to buyer')
     let currSellOffAf = offersAf.rows.find(el => el.id === 0)
@@ -1083,34 +1513,20 @@ describe('Escrow', async function () {
       }
     ])
 
-    const balances = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'balances',
-      json: true,
-      limit: 100
-    })
+    const balances = await getBalances()
 
-    assert.deepStrictEqual(balances.rows, [
-      {
-        "account": "seedsuseraaa",
-        "available_balance": "0.0000 SEEDS",
-        "swap_balance": "0.0000 SEEDS",
-        "escrow_balance": "0.0000 SEEDS"
-      }
-    ])
+    assert.deepStrictEqual(balances.rows, [firstuser, seconduser, thirduser].map(account => ({
+      "account": account,
+      "available_balance": "0.0000 SEEDS",
+      "swap_balance": "0.0000 SEEDS",
+      "escrow_balance": "0.0000 SEEDS"
+    })))
 
     const firstuserBalanceAfter = await getAccountBalance(seedsContracts.token, seconduser, seedsSymbol)
 
     assert.deepStrictEqual(firstuserBalanceAfter - firstuserBalanceBefore, 500.0)
 
-    const trxStats = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'trxstats',
-      json: true,
-      limit: 100
-    })
+    const trxStats = await getTrxStats()
 
     assert.deepStrictEqual(trxStats.rows, [
       {
@@ -1180,13 +1596,7 @@ describe('Escrow', async function () {
     console.log('add arbiter to arbitrage')
     await contracts.escrow.arbtrgeoffer(thirduser, 1, hyperionMemo, { authorization: `${thirduser}@active` })
 
-    const offersB = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offersB = await getOffers()
 
     let currSellOffBefore = offersB.rows[0]
 
@@ -1222,13 +1632,7 @@ describe('Escrow', async function () {
       }
     ])
 
-    const balances = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'balances',
-      json: true,
-      limit: 100
-    })
+    const balances = await getBalances()
 
     assert.deepStrictEqual(balances.rows[0],   {
       "account": "seedsuseraaa",
@@ -1237,13 +1641,7 @@ describe('Escrow', async function () {
       "escrow_balance": "0.0000 SEEDS"
     })
 
-    const offers = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offers = await getOffers()
 
     let currBuyOff = offers.rows[1]
     let currSellOff = offers.rows[0]
@@ -1260,6 +1658,92 @@ describe('Escrow', async function () {
     assert.deepStrictEqual(flaggedStatus.key, 'b.flagged')
   })
 
+  it('A resolved arbitration can not be taken and resolved again', async function() {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.addselloffer(firstuser, '1000.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '400.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.accptbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.payoffer(1, hyperionMemo, { authorization: `${seconduser}@active` })
+
+    await sleep(2000)
+
+    await setParamsValue(true)
+    await contracts.escrow.initarbitrage(1, hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addarbiter(thirduser, { authorization: `${escrow}@active` })
+    await contracts.escrow.arbtrgeoffer(thirduser, 1, hyperionMemo, { authorization: `${thirduser}@active` })
+    await contracts.escrow.resolvebuyer(1, 'Resolved to buyer', hyperionMemo, { authorization: `${thirduser}@active` })
+
+    const buyerBalanceBefore = await getAccountBalance(seedsContracts.token, seconduser, seedsSymbol)
+
+    let onlyPendingArbitrations = true
+    try {
+      await contracts.escrow.arbtrgeoffer(thirduser, 1, hyperionMemo, { authorization: `${thirduser}@active` })
+      onlyPendingArbitrations = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'this arbitration ticket isn\'t pending',
+        message: 'this arbitration ticket isn\'t pending (expected)',
+        throwError: true
+      })
+    }
+
+    let resolvedOnce = true
+    try {
+      await contracts.escrow.resolvebuyer(1, 'Resolved to buyer again', hyperionMemo, { authorization: `${thirduser}@active` })
+      resolvedOnce = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'this arbitration ticket isn\'t in progress',
+        message: 'this arbitration ticket isn\'t in progress (expected)',
+        throwError: true
+      })
+    }
+
+    const buyerBalanceAfter = await getAccountBalance(seedsContracts.token, seconduser, seedsSymbol)
+    const buyOffers = await getPartitionedRows('buyoffers')
+    const sellOffers = await getPartitionedRows('selloffers')
+
+    assert.deepStrictEqual(onlyPendingArbitrations, true)
+    assert.deepStrictEqual(resolvedOnce, true)
+    assert.deepStrictEqual(buyerBalanceAfter, buyerBalanceBefore)
+    assert.deepStrictEqual(buyOffers[0].current_status, 'b.success')
+    assert.deepStrictEqual(sellOffers[0].open_buy_offers, 0)
+  })
+
+  it('Resolve seller on a canceled sell offer returns the funds to the seller', async function() {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.addselloffer(firstuser, '1000.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '400.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.accptbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.cancelsoffer(0, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.payoffer(1, hyperionMemo, { authorization: `${seconduser}@active` })
+
+    await sleep(2000)
+
+    await setParamsValue(true)
+    await contracts.escrow.initarbitrage(1, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addarbiter(thirduser, { authorization: `${escrow}@active` })
+    await contracts.escrow.arbtrgeoffer(thirduser, 1, hyperionMemo, { authorization: `${thirduser}@active` })
+    await contracts.escrow.resolvesellr(1, 'Resolved to seller', hyperionMemo, { authorization: `${thirduser}@active` })
+
+    const balances = await getBalances()
+    const sellOffers = await getPartitionedRows('selloffers')
+
+    assert.deepStrictEqual(balances.rows[0], {
+      account: firstuser,
+      available_balance: '1000.0000 SEEDS',
+      swap_balance: '0.0000 SEEDS',
+      escrow_balance: '0.0000 SEEDS'
+    })
+    assert.deepStrictEqual(sellOffers[0].current_status, 's.canceled')
+    assert.deepStrictEqual(sellOffers[0].available, '0.0000 SEEDS')
+    assert.deepStrictEqual(sellOffers[0].open_buy_offers, 0)
+  })
+
   it('On confirm payment and it is soldout => it should mark sell off as success', async function() {
     console.log('transafer tokens')
     await seeds.token.transfer(firstuser, escrow, '2000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
@@ -1273,56 +1757,68 @@ describe('Escrow', async function () {
     await contracts.escrow.accptbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
 
     console.log('Confirm to sell half of offered seeds')
-    const offersTable1 = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offersTable1 = await getOffers()
 
     assert.deepStrictEqual(offersTable1.rows[0].current_status, 's.active')
 
     await contracts.escrow.accptbuyoffr(2, hyperionMemo, { authorization: `${firstuser}@active` })
 
     console.log('Confirm to sell half of offered seeds')
-    const offersTable2 = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offersTable2 = await getOffers()
 
     assert.deepStrictEqual(offersTable2.rows[0].current_status, 's.soldout')
 
     await contracts.escrow.payoffer(1, hyperionMemo, { authorization: `${seconduser}@active` })
     await contracts.escrow.confrmpaymnt(1, hyperionMemo, { authorization: `${firstuser}@active` })
 
-    const offersTable = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offersTable = await getOffers()
 
     assert.deepStrictEqual(offersTable.rows[0].current_status, 's.soldout')
 
     await contracts.escrow.payoffer(2, hyperionMemo, { authorization: `${thirduser}@active` })
     await contracts.escrow.confrmpaymnt(2, hyperionMemo, { authorization: `${firstuser}@active` })
 
-    const offersTable3 = await rpc.get_table_rows({
-      code: escrow,
-      scope: escrow,
-      table: 'offers',
-      json: true,
-      limit: 100
-    })
+    const offersTable3 = await getOffers()
 
     assert.deepStrictEqual(offersTable3.rows[0].current_status, 's.successful')
   })
 
+  it('Leaderboards keep the top accounts by successful trades', async function () {
+    const getBoard = async (scope) => (await rpc.get_table_rows({ code: escrow, scope, table: 'leaderboard', json: true, limit: 10 })).rows
+
+    await contracts.escrow.setparam('l.size', ['uint64', 1], '', { authorization: `${escrow}@active` })
+
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '1000.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '500.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addbuyoffer(thirduser, 0, '500.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${thirduser}@active` })
+
+    for (const [buyOfferId, buyer] of [[1, seconduser], [2, thirduser]]) {
+      await contracts.escrow.accptbuyoffr(buyOfferId, hyperionMemo, { authorization: `${firstuser}@active` })
+      await contracts.escrow.payoffer(buyOfferId, hyperionMemo, { authorization: `${buyer}@active` })
+      await contracts.escrow.confrmpaymnt(buyOfferId, hyperionMemo, { authorization: `${firstuser}@active` })
+    }
+
+    const totalBoard = await getBoard('total')
+    const sellBoard = await getBoard('sell')
+    const buyBoard = await getBoard('buy')
+
+    console.log('a tie with the lowest ranked account does not enter a full board')
+    assert.deepStrictEqual(totalBoard, [{ account: firstuser, successful: 2 }])
+    assert.deepStrictEqual(sellBoard, [{ account: firstuser, successful: 2 }])
+    assert.deepStrictEqual(buyBoard, [{ account: seconduser, successful: 1 }])
+
+    console.log('rankusers fills the boards from the ledger')
+    await contracts.escrow.setparam('l.size', ['uint64', 10], '', { authorization: `${escrow}@active` })
+    await contracts.escrow.rankusers(100, { authorization: `${fourthuser}@active` })
+
+    const buyBoardAfter = await getBoard('buy')
+
+    await setParamsValue()
+
+    assert.deepStrictEqual(buyBoardAfter.map(item => item.account).sort(), [seconduser, thirduser].sort())
+  })
+
   it('Settings, set a new param', async function () {
     await contracts.escrow.setparam('testparam', ['uint64', 20], 'test param', { authorization: `${escrow}@active` })
 
@@ -1337,6 +1833,60 @@ describe('Escrow', async function () {
     console.log(JSON.stringify(settingsParam, null, 2))
   })
 
+  it('Settings, known params are kept in the typed settings row', async function () {
+    await contracts.escrow.setparam('b.accpt.lim', ['uint64', 100], '', { authorization: `${escrow}@active` })
+
+    const settings = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'settings', json: true, limit: 1 })
+
+    await setParamsValue()
+
+    assert.deepStrictEqual(settings.rows[0].accept_limit, 100)
+    assert.deepStrictEqual(settings.rows[0].initialized, 0b1111111111)
+
+    let onlyUint64 = true
+    try {
+      await contracts.escrow.setparam('b.accpt.lim', ['string', '100'], '', { authorization: `${escrow}@active` })
+      onlyUint64 = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'the b.accpt.lim parameter must be a uint64',
+        message: 'the b.accpt.lim parameter must be a uint64 (expected)',
+        throwError: true
+      })
+    }
+
+    let onlyContract = true
+    try {
+      await contracts.escrow.setparam('b.accpt.lim', ['uint64', 0], '', { authorization: `${firstuser}@active` })
+      onlyContract = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: `missing authority of ${escrow}`,
+        message: `missing authority of ${escrow} (expected)`,
+        throwError: true
+      })
+    }
+
+    console.log('unset params fall back to their defaults')
+    await contracts.escrow.resetsttngs({ authorization: `${escrow}@active` })
+    await contracts.escrow.setparam('b.accpt.lim', ['uint64', 100], '', { authorization: `${escrow}@active` })
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '100.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.cancelsoffer(0, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    const partialSettings = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'settings', json: true, limit: 1 })
+    const sellOffers = await getPartitionedRows('selloffers')
+
+    await setParamsValue()
+
+    assert.deepStrictEqual(onlyUint64, true)
+    assert.deepStrictEqual(onlyContract, true)
+    assert.deepStrictEqual(partialSettings.rows[0].initialized, 0b1)
+    assert.deepStrictEqual(sellOffers[0].current_status, 's.canceled')
+  })
+
   it('Send contact methods to arbiter', async function() {
     console.log('transafer tokens')
     await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
@@ -1345,8 +1895,12 @@ describe('Escrow', async function () {
     await contracts.escrow.addselloffer(firstuser, '1000.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
     await contracts.escrow.addbuyoffer(seconduser, 0, '1000.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
     await contracts.escrow.accptbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.payoffer(1, hyperionMemo, { authorization: `${seconduser}@active` })
 
-    console.log('Buyer don\'t confirm pay so seller init arbitrage')
+    await sleep(2000)
+
+    console.log('Seller does not receive the payment so seller init arbitrage')
+    await setParamsValue(true)
     await contracts.escrow.initarbitrage(1, hyperionMemo, { authorization: `${firstuser}@active` })
 
     console.log('create arbiter')
@@ -1425,6 +1979,186 @@ describe('Escrow', async function () {
     ])
   })
 
+  it('Hash only messages', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '500.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+
+    await contracts.escrow.setparam('m.hash.only', ['uint64', 1], '', { authorization: `${escrow}@active` })
+
+    const iv = '4251f90f2a58a4cf78bf70f95e4f772f'
+    const ephemKey = 'PUB_K1_6utVJ2S4zHZCiJvTxDhRVUst5RM5zB8foUaCEqEw34dz9wFh5v'
+    const message = '69e4210d9a46daf32bb01bd999770d23f5953b030ea53c93dd7e8f881907d57d'
+    const mac = 'a350ac97f1d22e7cb2abaa4ab47a626768d0835e5aa2f6a7ed140bcd46d50165'
+
+    await contracts.escrow.addoffermsg(1, iv, ephemKey, message, mac, hyperionMemo, { authorization: `${seconduser}@active` })
+
+    const messages = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'pmessages', json: true, limit: 10 })
+    const anchors = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'msganchors', json: true, limit: 10 })
+
+    await setParamsValue()
+
+    console.log('a stored message after the anchor takes the next id of the shared space')
+    await contracts.escrow.addoffermsg(1, iv, ephemKey, message, mac, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    const firstPage = await query('getmessages', { buy_offer_id: 1, cursor: 0, limit: 1 }, seconduser)
+    const secondPage = await query('getmessages', { buy_offer_id: 1, cursor: firstPage.next_cursor, limit: 1 }, seconduser)
+
+    await contracts.escrow.delprivtemsg(0, hyperionMemo, { authorization: `${seconduser}@active` })
+    const anchorsAfterDelete = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'msganchors', json: true, limit: 10 })
+    const messagesAfterDelete = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'pmessages', json: true, limit: 10 })
+
+    // strings shorter than 128 bytes are packed with a one byte length prefix
+    const packString = str => Buffer.concat([Buffer.from([str.length]), Buffer.from(str)])
+    const payload = Buffer.concat([packString(iv), packString(ephemKey), packString(message), Buffer.from(mac, 'hex')])
+    const payloadHash = require('crypto').createHash('sha256').update(payload).digest('hex')
+
+    assert.deepStrictEqual(messages.rows.length, 0)
+    assert.deepStrictEqual(anchors.rows.map(anchor => [anchor.buy_offer_id, anchor.sender, anchor.receiver, anchor.payload_hash]), [
+      [1, seconduser, firstuser, payloadHash]
+    ])
+
+    assert.deepStrictEqual(firstPage, {
+      messages: [],
+      anchors: [{ id: 0, sender: seconduser, receiver: firstuser, payload_hash: payloadHash }],
+      next_cursor: 1,
+      more: true
+    })
+    assert.deepStrictEqual(secondPage.messages.map(msg => [msg.id, msg.sender, msg.message]), [[1, firstuser, message]])
+    assert.deepStrictEqual(secondPage.anchors, [])
+    assert.deepStrictEqual(secondPage.more, false)
+
+    assert.deepStrictEqual(anchorsAfterDelete.rows.length, 0)
+    assert.deepStrictEqual(messagesAfterDelete.rows.map(msg => msg.id), [1])
+  })
+
+  it('Sweep expired pending and unpaid accepted buy offers', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '500.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '500.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addbuyoffer(thirduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${thirduser}@active` })
+    await contracts.escrow.accptbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.setparam('b.accpt.lim', ['uint64', 0], '', { authorization: `${escrow}@active` })
+    await contracts.escrow.setparam('b.pay.lim', ['uint64', 0], '', { authorization: `${escrow}@active` })
+    await sleep(1000)
+    await contracts.escrow.sweep(10, { authorization: `${fourthuser}@active` })
+
+    const buyOffers = await getPartitionedRows('buyoffers')
+    const sellOffers = await getPartitionedRows('selloffers')
+    const balances = await getBalances()
+
+    await setParamsValue()
+
+    console.log('both buy offers are rejected')
+    assert.deepStrictEqual(buyOffers.map(offer => offer.current_status), ['b.rejected', 'b.rejected'])
+
+    console.log('the soldout sell offer is active again')
+    assert.deepStrictEqual(sellOffers[0].current_status, 's.active')
+    assert.deepStrictEqual(sellOffers[0].available, '500.0000 SEEDS')
+    assert.deepStrictEqual(sellOffers[0].open_buy_offers, 0)
+
+    const sellerBalance = balances.rows.find(balance => balance.account === firstuser)
+    assert.deepStrictEqual(sellerBalance.swap_balance, '500.0000 SEEDS')
+    assert.deepStrictEqual(sellerBalance.escrow_balance, '0.0000 SEEDS')
+  })
+
+  it('Prune messages of finished buy offers', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '500.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addbuyoffer(thirduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${thirduser}@active` })
+
+    const mac = 'a350ac97f1d22e7cb2abaa4ab47a626768d0835e5aa2f6a7ed140bcd46d50165'
+    await contracts.escrow.addoffermsg(1, 'iv', 'key', 'first', mac, hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addoffermsg(1, 'iv', 'key', 'second', mac, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addoffermsg(2, 'iv', 'key', 'third', mac, hyperionMemo, { authorization: `${thirduser}@active` })
+
+    await contracts.escrow.rejctbuyoffr(1, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.setparam('m.retention', ['uint64', 0], '', { authorization: `${escrow}@active` })
+    await contracts.escrow.prunemsgs(10, { authorization: `${fourthuser}@active` })
+
+    const messages = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'pmessages', json: true, limit: 10 })
+
+    await setParamsValue()
+
+    console.log('only the messages of the rejected buy offer are erased')
+    assert.deepStrictEqual(messages.rows.map(message => message.message), ['third'])
+  })
+
+  it('Prune terminal offers', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+
+    await contracts.escrow.addselloffer(firstuser, '500.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '300.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '500.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addbuyoffer(thirduser, 1, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${thirduser}@active` })
+
+    await contracts.escrow.accptbuyoffr(2, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.payoffer(2, hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.confrmpaymnt(2, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.accptbuyoffr(3, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.cancelsoffer(1, hyperionMemo, { authorization: `${firstuser}@active` })
+
+    console.log('nothing is old enough with the default age')
+    await contracts.escrow.prune(100, { authorization: `${fourthuser}@active` })
+    assert.deepStrictEqual((await getOffers()).rows.length, 4)
+
+    await contracts.escrow.setparam('o.prune.age', ['uint64', 0], '', { authorization: `${escrow}@active` })
+    await sleep(1000)
+    await contracts.escrow.prune(100, { authorization: `${fourthuser}@active` })
+
+    const offers = await getOffers()
+    const relations = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'buysellrel', json: true, limit: 100 })
+
+    await setParamsValue()
+
+    console.log('the canceled sell offer stays while its accepted buy offer is open')
+    assert.deepStrictEqual(offers.rows.map(offer => offer.id), [1, 3])
+    assert.deepStrictEqual(relations.rows.map(rel => rel.buy_offer_id), [3])
+  })
+
+  it('Reset in bounded chunks', async function () {
+    await seeds.token.transfer(firstuser, escrow, '1000.0000 SEEDS', '', { authorization: `${firstuser}@active` })
+    await contracts.escrow.addselloffer(firstuser, '1000.0000 SEEDS', 11000, hyperionMemo, { authorization: `${firstuser}@active` })
+    await contracts.escrow.addbuyoffer(seconduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${seconduser}@active` })
+    await contracts.escrow.addbuyoffer(thirduser, 0, '100.0000 SEEDS', 'paypal', hyperionMemo, { authorization: `${thirduser}@active` })
+
+    const getResetState = async () => {
+      const res = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'resetstate', json: true, limit: 1 })
+      return res.rows[0]
+    }
+
+    let onlyOneKindOfReset = true
+    await contracts.escrow.resetchunk(2, true, { authorization: `${escrow}@active` })
+    try {
+      await contracts.escrow.resetchunk(2, false, { authorization: `${escrow}@active` })
+      onlyOneKindOfReset = false
+    } catch (error) {
+      assertError({
+        error,
+        textInside: 'a reset with a different offers_only value is in progress',
+        message: 'a reset with a different offers_only value is in progress (expected)',
+        throwError: true
+      })
+    }
+
+    let calls = 1
+    while (await getResetState()) {
+      await contracts.escrow.resetchunk(2, true, { authorization: `${escrow}@active` })
+      calls += 1
+    }
+
+    const offers = await getOffers()
+    const users = await rpc.get_table_rows({ code: escrow, scope: escrow, table: 'users', json: true, limit: 100 })
+
+    assert.deepStrictEqual(onlyOneKindOfReset, true)
+    assert.ok(calls > 1)
+    assert.deepStrictEqual(offers.rows, [])
+    assert.deepStrictEqual(users.rows.length, 3)
+  })
+
   it('Reset settings', async function() {
     await contracts.escrow.resetsttngs({ authorization: `${escrow}@active` })
   })